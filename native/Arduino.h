@@ -0,0 +1,205 @@
+#pragma once
+
+// Minimal Arduino core replacement for the native (host) build.
+// It provides just enough of the Arduino/ESP API for the acquisition,
+// battery status and VE.Direct code to compile and run on Linux.
+// Time is virtual: it only advances when the simulation (or a blocking
+// call like delay()) advances it, so runs are deterministic and fast.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <string>
+
+#define ARDUINO 10819
+#define NATIVE_BUILD 1
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define LED_BUILTIN 16
+
+#define DEC 10
+#define HEX 16
+
+// The native "board" uses the NodeMCU pin names
+#define D1 5
+#define D2 4
+#define D5 14
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::max;
+using std::min;
+
+// -- Virtual time
+unsigned long millis();
+unsigned long micros();
+uint64_t micros64();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// -- Interrupts
+#define digitalPinToInterrupt(p) (p)
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// -- Hooks for the simulation harness
+
+// Simulated peripherals that have to act at a certain point in virtual time
+// (conversion finished, byte shifted out, ...) implement this interface.
+class NativeTimed {
+public:
+    virtual ~NativeTimed() {}
+    // Virtual time of the next internal event, UINT64_MAX if there is none
+    virtual uint64_t nativeNextEvent() = 0;
+    virtual void nativeOnTime(uint64_t nowUs) = 0;
+};
+
+void nativeAddTimed(NativeTimed* timed);
+void nativeAdvanceMicros(uint64_t us);
+// Raise an edge on an input pin. The attached ISR runs as soon as interrupts
+// are enabled and no bus transaction is in progress.
+void nativeRaiseInterrupt(uint8_t pin);
+// An open drain output starts or stops pulling an input pin low. Several
+// outputs can share a pin, the falling edge raises an interrupt.
+void nativePullLow(uint8_t pin, bool active);
+void nativeEnterCritical();
+void nativeLeaveCritical();
+
+// -- Arduino String, backed by std::string
+class String {
+public:
+    String() {}
+    String(const char* s) : str(s ? s : "") {}
+    String(const std::string& s) : str(s) {}
+    explicit String(char c) : str(1, c) {}
+    String(int value, unsigned char base = 10) { fromLong(value, base); }
+    String(unsigned int value, unsigned char base = 10) { fromULong(value, base); }
+    String(long value, unsigned char base = 10) { fromLong(value, base); }
+    String(unsigned long value, unsigned char base = 10) { fromULong(value, base); }
+    String(float value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+    String(double value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+
+    unsigned int length() const { return str.length(); }
+    const char* c_str() const { return str.c_str(); }
+    bool isEmpty() const { return str.empty(); }
+    char operator[](unsigned int index) const { return index < str.length() ? str[index] : 0; }
+    char& operator[](unsigned int index) { return str[index]; }
+
+    String& operator+=(const String& rhs) { str += rhs.str; return *this; }
+    String& operator+=(const char* rhs) { str += rhs; return *this; }
+    String& operator+=(char rhs) { str += rhs; return *this; }
+    bool operator==(const String& rhs) const { return str == rhs.str; }
+    bool operator==(const char* rhs) const { return str == rhs; }
+
+    void trim();
+    long toInt() const { return atol(str.c_str()); }
+    float toFloat() const { return atof(str.c_str()); }
+
+    friend String operator+(const String& lhs, const String& rhs) { return String(lhs.str + rhs.str); }
+    friend String operator+(const char* lhs, const String& rhs) { return String(lhs + rhs.str); }
+    friend String operator+(const String& lhs, const char* rhs) { return String(lhs.str + rhs); }
+
+private:
+    void fromLong(long value, unsigned char base);
+    void fromULong(unsigned long value, unsigned char base);
+    void fromDouble(double value, unsigned char decimals);
+    std::string str;
+};
+
+// -- Serial port. TX goes to an optional FILE sink, RX is fed by the harness.
+class HardwareSerial {
+public:
+    explicit HardwareSerial(int uartNr) : uart(uartNr) {}
+
+    void begin(unsigned long baud) { baud_ = baud; }
+    void begin(unsigned long baud, int) { begin(baud); }
+    unsigned long baudRate() const { return baud_; }
+    void updateBaudRate(unsigned long baud) { baud_ = baud; }
+    void setTimeout(unsigned long ms) { timeout = ms; }
+
+    int available() const { return (int)(rx.size() - rxPos); }
+    int read();
+    int peek();
+    size_t readBytes(char* buffer, size_t length);
+    // Room in the TX FIFO, it drains at the baud rate in virtual time
+    int availableForWrite();
+    void flush() {}
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+    size_t print(const char* str) { return write(str); }
+    size_t print(const String& s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(unsigned int value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(long value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(unsigned long value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(double value, int decimals = 2) { return print(String(value, (unsigned char)decimals)); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+    template <typename T> size_t println(T value, int format) { return print(value, format) + println(); }
+    size_t println() { return write("\r\n"); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    // Harness side
+    void nativeSetSink(FILE* file) { sink = file; }
+    void nativeInject(const char* data, size_t length);
+    // Virtual time write() waited for room in the TX FIFO
+    uint64_t nativeTxBlockedUs() const { return txBlockedUs; }
+
+private:
+    static const int TX_FIFO = 128;
+
+    void drainTx();
+
+    int uart;
+    unsigned long baud_ = 0;
+    unsigned long timeout = 1000;
+    int txFifo = 0;
+    uint64_t txLastUs = 0;
+    uint64_t txBlockedUs = 0;
+    FILE* sink = 0;
+    std::string rx;
+    size_t rxPos = 0;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+// -- ESP specific functions
+class EspClass {
+public:
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+    uint32_t getChipId() { return 0x00C0FFEE; }
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getCycleCount();
+    void restart() {}
+};
+
+extern EspClass ESP;
@@ -0,0 +1,60 @@
+#pragma once
+
+// I2C bus replacement for the native build. Transactions are routed to
+// simulated devices registered at their 7 bit address. Every transaction
+// advances the virtual clock by the time it would take on the wire at the
+// configured bus clock, so I2C cost shows up in the measured timings.
+
+#include <Arduino.h>
+
+class NativeI2cDevice {
+public:
+    virtual ~NativeI2cDevice() {}
+    // Master writes data to the device
+    virtual void i2cWrite(const uint8_t* data, size_t length) = 0;
+    // Master reads data from the device
+    virtual void i2cRead(uint8_t* data, size_t length) = 0;
+};
+
+struct NativeI2cStats {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint64_t busTimeUs;
+};
+
+class TwoWire {
+public:
+    void begin() {}
+    void begin(int sda, int scl) { (void)sda; (void)scl; }
+    void setClock(uint32_t frequency) { clock = frequency; }
+
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t length);
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (uint8_t)quantity); }
+    int available() const { return (int)(rxLength - rxIndex); }
+    int read() { return rxIndex < rxLength ? rxBuffer[rxIndex++] : -1; }
+
+    // Harness side
+    void nativeAttach(uint8_t address, NativeI2cDevice* device);
+    const NativeI2cStats& nativeStats() const { return stats; }
+    void nativeResetStats() { stats = NativeI2cStats(); }
+
+private:
+    void busTime(size_t bytes);
+
+    NativeI2cDevice* devices[128] = {};
+    uint32_t clock = 100000;
+    uint8_t txAddress = 0;
+    uint8_t txBuffer[32];
+    size_t txLength = 0;
+    uint8_t rxBuffer[32];
+    size_t rxLength = 0;
+    size_t rxIndex = 0;
+    NativeI2cStats stats = {};
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,80 @@
+#include "flashSim.h"
+
+// W25Q32 typical values. Reads at 40MHz dual I/O.
+static const uint64_t READ_SETUP_US = 2;
+static const double READ_US_PER_BYTE = 0.1;
+static const uint32_t PAGE_SIZE = 256;
+static const uint64_t PAGE_PROGRAM_US = 700;
+static const uint64_t SECTOR_ERASE_US = 45000;
+
+NorFlashSim::NorFlashSim(uint32_t numSectors, uint32_t sectorSize)
+    : sectorBytes(sectorSize), memory(numSectors * sectorSize, 0xFF), sectorErases(numSectors, 0) {}
+
+bool NorFlashSim::valid(uint32_t address, size_t size) const {
+    return !powerLost && (address & 3) == 0 && (size & 3) == 0 && address + size <= memory.size();
+}
+
+void NorFlashSim::busy(uint64_t us) {
+    counters.busyUs += us;
+    nativeEnterCritical();
+    nativeAdvanceMicros(us);
+    nativeLeaveCritical();
+}
+
+bool NorFlashSim::read(uint32_t address, uint32_t* data, size_t size) {
+    if (!valid(address, size)) {
+        return false;
+    }
+    memcpy(data, &memory[address], size);
+    counters.bytesRead += size;
+    busy(READ_SETUP_US + (uint64_t)(size * READ_US_PER_BYTE));
+    return true;
+}
+
+bool NorFlashSim::write(uint32_t address, const uint32_t* data, size_t size) {
+    if (!valid(address, size)) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        if (cutArmed && cutBudget-- == 0) {
+            powerLost = true;
+            return false;
+        }
+        memory[address + i] &= bytes[i];
+    }
+    counters.bytesProgrammed += size;
+    // Every page touched is one program cycle
+    uint32_t pages = (address + size - 1) / PAGE_SIZE - address / PAGE_SIZE + 1;
+    busy(pages * PAGE_PROGRAM_US);
+    return true;
+}
+
+bool NorFlashSim::eraseSector(uint32_t sector) {
+    if (powerLost || sector >= sectorErases.size()) {
+        return false;
+    }
+    uint8_t* start = &memory[sector * sectorBytes];
+    if (cutArmed) {
+        if (cutBudget < sectorBytes) {
+            // Half erased, the rest keeps its old content
+            memset(start, 0xFF, cutBudget);
+            powerLost = true;
+            return false;
+        }
+        cutBudget -= sectorBytes;
+    }
+    memset(start, 0xFF, sectorBytes);
+    ++counters.erases;
+    ++sectorErases[sector];
+    busy(SECTOR_ERASE_US);
+    return true;
+}
+
+// 64 sectors, like a small spiffs partition
+NorFlashSim& nativeFlash() {
+    static NorFlashSim flash(64);
+    return flash;
+}
+
+FlashRegion* flashDataRegion() { return &nativeFlash(); }
@@ -0,0 +1,58 @@
+#pragma once
+
+// NOR flash model for the native build.
+//
+// Erasing sets every bit of a sector, programming can only clear bits, like
+// on the SPI flash of the ESP boards. Operations take virtual time with the
+// typical timing of a W25Q32 (the CPU is blocked meanwhile, as on the
+// ESP8266), and are counted so write amplification and wear can be
+// measured. A power cut can be injected to test recovery.
+
+#include <Arduino.h>
+#include <vector>
+
+#include "flashRegion.h"
+
+class NorFlashSim : public FlashRegion {
+public:
+    struct Stats {
+        uint64_t bytesRead;
+        uint64_t bytesProgrammed;
+        uint32_t erases;
+        uint64_t busyUs;
+    };
+
+    NorFlashSim(uint32_t numSectors, uint32_t sectorSize = 4096);
+
+    uint32_t size() const override { return memory.size(); }
+    uint32_t sectorSize() const override { return sectorBytes; }
+    bool read(uint32_t address, uint32_t* data, size_t size) override;
+    bool write(uint32_t address, const uint32_t* data, size_t size) override;
+    bool eraseSector(uint32_t sector) override;
+
+    // Only the next bytes bytes get programmed, then the power is gone and
+    // everything fails until powerOn(). An erase in progress leaves the
+    // sector half erased.
+    void cutPowerAfter(uint32_t bytes) { cutBudget = bytes; cutArmed = true; }
+    void powerOn() { cutArmed = false; powerLost = false; }
+    bool powerIsLost() const { return powerLost; }
+
+    const Stats& stats() const { return counters; }
+    void resetStats() { counters = Stats(); }
+    uint32_t eraseCount(uint32_t sector) const { return sectorErases[sector]; }
+
+private:
+    bool valid(uint32_t address, size_t size) const;
+    void busy(uint64_t us);
+
+    uint32_t sectorBytes;
+    std::vector<uint8_t> memory;
+    std::vector<uint32_t> sectorErases;
+    Stats counters = Stats();
+    bool cutArmed = false;
+    bool powerLost = false;
+    uint32_t cutBudget = 0;
+};
+
+// The flash the firmware's journal uses in the native build
+NorFlashSim& nativeFlash();
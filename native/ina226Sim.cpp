@@ -0,0 +1,183 @@
+#include "ina226Sim.h"
+
+static const uint16_t CONFIG_DEFAULT = 0x4127;
+static const uint16_t MANUFACTURER_ID = 0x5449;
+static const uint16_t DIE_ID = 0x2260;
+
+static const uint16_t BIT_CNVR = 0x0400;
+static const uint16_t BIT_CVRF = 0x0008;
+static const uint16_t BIT_APOL = 0x0002;
+static const uint16_t MASK_WRITABLE = 0xFC03;
+
+static const float SHUNT_LSB = 0.0000025f;
+static const float BUS_LSB = 0.00125f;
+
+static const uint16_t conversionTimes[8] = {140, 204, 332, 588, 1100, 2116, 4156, 8244};
+static const uint16_t averages[8] = {1, 4, 16, 64, 128, 256, 512, 1024};
+
+Ina226Sim::Ina226Sim(uint8_t alertPin, float shuntOhm)
+    : alertPin(alertPin), shuntOhm(shuntOhm), rng(4711), gauss(0.0f, 1.0f) {
+    currentSource = [](uint64_t) { return 0.0f; };
+    busSource = [](uint64_t) { return 12.0f; };
+    reset();
+}
+
+void Ina226Sim::setNoise(float shuntNoiseV, float busNoiseV) {
+    shuntNoise = shuntNoiseV;
+    busNoise = busNoiseV;
+}
+
+void Ina226Sim::reset() {
+    memset(regs, 0, sizeof(regs));
+    regs[REG_CONFIG] = CONFIG_DEFAULT;
+    setAlert(false);
+    startConversion(micros64());
+}
+
+uint64_t Ina226Sim::conversionTimeUs() const {
+    uint16_t config = regs[REG_CONFIG];
+    uint8_t mode = config & 0x7;
+    uint32_t time = 0;
+    if (mode & 0x1) {
+        time += conversionTimes[(config >> 3) & 0x7];
+    }
+    if (mode & 0x2) {
+        time += conversionTimes[(config >> 6) & 0x7];
+    }
+    return (uint64_t)(time * averages[(config >> 9) & 0x7] * clockFactor + 0.5f);
+}
+
+void Ina226Sim::startConversion(uint64_t now) {
+    uint8_t mode = regs[REG_CONFIG] & 0x7;
+    conversionStart = now;
+    if (mode == 0 || mode == 4) {
+        // Power down or ADC off
+        conversionEnd = UINT64_MAX;
+    } else {
+        conversionEnd = now + conversionTimeUs();
+    }
+}
+
+void Ina226Sim::setAlert(bool active) {
+    // ALERT is open drain and active low by default. Several chips may
+    // share the line, it is low as long as one of them pulls it.
+    bool pull = active && !(regs[REG_MASK] & BIT_APOL);
+    if (pull != pullsLow) {
+        nativePullLow(alertPin, pull);
+        pullsLow = pull;
+    }
+    alert = active;
+}
+
+void Ina226Sim::updateCurrentAndPower() {
+    int32_t current = ((int32_t)(int16_t)regs[REG_SHUNT] * (int32_t)regs[REG_CALIBRATION]) / 2048;
+    current = constrain(current, -32768, 32767);
+    regs[REG_CURRENT] = (uint16_t)(int16_t)current;
+    int32_t power = (abs(current) * (int32_t)regs[REG_BUS]) / 20000;
+    regs[REG_POWER] = (uint16_t)min(power, (int32_t)0xFFFF);
+}
+
+void Ina226Sim::nativeOnTime(uint64_t nowUs) {
+    uint16_t config = regs[REG_CONFIG];
+    uint8_t mode = config & 0x7;
+    uint16_t numAverages = averages[(config >> 9) & 0x7];
+    uint64_t duration = conversionEnd - conversionStart;
+
+    double shuntSum = 0;
+    double busSum = 0;
+    for (uint16_t i = 0; i < numAverages; ++i) {
+        uint64_t t = conversionStart + (duration * (2 * i + 1)) / (2 * numAverages);
+        shuntSum += currentSource(t) * shuntOhm + shuntNoise * gauss(rng);
+        busSum += busSource(t) + busNoise * gauss(rng);
+    }
+
+    if (mode & 0x1) {
+        long raw = lround(shuntSum / numAverages / SHUNT_LSB);
+        regs[REG_SHUNT] = (uint16_t)(int16_t)constrain(raw, -32768L, 32767L);
+    }
+    if (mode & 0x2) {
+        long raw = lround(busSum / numAverages / BUS_LSB);
+        regs[REG_BUS] = (uint16_t)constrain(raw, 0L, 32767L);
+    }
+    updateCurrentAndPower();
+    ++numConversions;
+
+    regs[REG_MASK] |= BIT_CVRF;
+    if (regs[REG_MASK] & BIT_CNVR) {
+        setAlert(true);
+    }
+
+    if (mode & 0x4) {
+        startConversion(nowUs);
+    } else {
+        // Triggered mode, wait for the next write to the config register
+        conversionEnd = UINT64_MAX;
+    }
+}
+
+void Ina226Sim::writeRegister(uint8_t index, uint16_t value) {
+    switch (index) {
+        case REG_CONFIG:
+            if (value & 0x8000) {
+                reset();
+                return;
+            }
+            regs[REG_CONFIG] = value;
+            // Writing the configuration aborts the running conversion
+            // and clears the conversion ready flag.
+            regs[REG_MASK] &= ~BIT_CVRF;
+            setAlert(false);
+            startConversion(micros64());
+            break;
+        case REG_CALIBRATION:
+            regs[REG_CALIBRATION] = value & 0x7FFF;
+            updateCurrentAndPower();
+            break;
+        case REG_MASK:
+            regs[REG_MASK] = (regs[REG_MASK] & ~MASK_WRITABLE) | (value & MASK_WRITABLE);
+            break;
+        case REG_LIMIT:
+            regs[REG_LIMIT] = value;
+            break;
+        default:
+            // Read only
+            break;
+    }
+}
+
+uint16_t Ina226Sim::readRegister(uint8_t index) {
+    uint16_t value;
+    switch (index) {
+        case 0xFE:
+            return MANUFACTURER_ID;
+        case 0xFF:
+            return DIE_ID;
+        case REG_MASK:
+            value = regs[REG_MASK];
+            // Reading Mask/Enable clears the flag and releases ALERT
+            regs[REG_MASK] &= ~BIT_CVRF;
+            setAlert(false);
+            return value;
+        default:
+            return index < 8 ? regs[index] : 0;
+    }
+}
+
+void Ina226Sim::i2cWrite(const uint8_t* data, size_t length) {
+    pointer = data[0];
+    if (length >= 3) {
+        writeRegister(pointer, (uint16_t)(data[1] << 8 | data[2]));
+    }
+}
+
+void Ina226Sim::i2cRead(uint8_t* data, size_t length) {
+    uint16_t value = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if ((i & 1) == 0) {
+            value = readRegister(pointer);
+            data[i] = value >> 8;
+        } else {
+            data[i] = value & 0xFF;
+        }
+    }
+}
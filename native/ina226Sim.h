@@ -0,0 +1,83 @@
+#pragma once
+
+// Register level model of a TI INA226 for the native build.
+//
+// The model implements the register file (configuration, shunt/bus voltage,
+// power, current, calibration, mask/enable, alert limit and the ID
+// registers), continuous and triggered conversions with the configured
+// conversion times and averaging, and the conversion ready flag together
+// with the open drain ALERT output. The ALERT line is wired to a native
+// interrupt pin, so the firmware ISR fires like on the real hardware.
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <functional>
+#include <random>
+
+class Ina226Sim : public NativeI2cDevice, public NativeTimed {
+public:
+    // Signal seen by the chip at a point in virtual time
+    typedef std::function<float(uint64_t us)> Signal;
+
+    Ina226Sim(uint8_t alertPin, float shuntOhm);
+
+    // Current through the shunt in A, positive when charging
+    void setCurrentSource(Signal source) { currentSource = source; }
+    // Voltage at the VBUS pin in V (after any divider)
+    void setBusSource(Signal source) { busSource = source; }
+    // RMS noise added to every single ADC sample
+    void setNoise(float shuntNoiseV, float busNoiseV);
+    // The internal oscillator is only accurate to a few percent. A value of
+    // 1.01 makes every conversion take 1% longer than the datasheet says.
+    void setClockError(float factor) { clockFactor = factor; }
+
+    uint32_t conversions() const { return numConversions; }
+    bool alertActive() const { return alert; }
+    uint16_t reg(uint8_t index) const { return regs[index & 7]; }
+
+    // NativeI2cDevice
+    void i2cWrite(const uint8_t* data, size_t length) override;
+    void i2cRead(uint8_t* data, size_t length) override;
+
+    // NativeTimed
+    uint64_t nativeNextEvent() override { return conversionEnd; }
+    void nativeOnTime(uint64_t nowUs) override;
+
+private:
+    enum {
+        REG_CONFIG = 0,
+        REG_SHUNT = 1,
+        REG_BUS = 2,
+        REG_POWER = 3,
+        REG_CURRENT = 4,
+        REG_CALIBRATION = 5,
+        REG_MASK = 6,
+        REG_LIMIT = 7
+    };
+
+    void reset();
+    void writeRegister(uint8_t index, uint16_t value);
+    uint16_t readRegister(uint8_t index);
+    void startConversion(uint64_t now);
+    uint64_t conversionTimeUs() const;
+    void updateCurrentAndPower();
+    void setAlert(bool active);
+
+    uint8_t alertPin;
+    float shuntOhm;
+    Signal currentSource;
+    Signal busSource;
+    float shuntNoise = 0;
+    float busNoise = 0;
+    float clockFactor = 1.0f;
+    std::mt19937 rng;
+    std::normal_distribution<float> gauss;
+
+    uint16_t regs[8];
+    uint8_t pointer = 0;
+    bool alert = false;
+    bool pullsLow = false;
+    uint64_t conversionStart = 0;
+    uint64_t conversionEnd = UINT64_MAX;
+    uint32_t numConversions = 0;
+};
@@ -0,0 +1,38 @@
+// Configuration values for the native build. On the target these live in
+// webHandling.cpp and are filled from the IotWebConf parameters, here they
+// get the same defaults the web configuration uses.
+
+#include "common.h"
+#include "webHandling.h"
+
+bool gParamsChanged = true;
+uint16_t gCapacityAh = 100;
+uint16_t gChargeEfficiencyPercent = 95;
+uint16_t gMinPercent = 10;
+uint16_t gTailCurrentmA = 1000;
+uint16_t gFullVoltagemV = 55200;
+uint16_t gFullDelayS = 30;
+float gShuntResistancemR = 0.75f;
+float gVoltageCalibrationFactor = 2.93892f;
+float gCurrentCalibrationFactor = 1.0f;
+uint16_t gMaxCurrentA = 200;
+uint16_t gModbusId = 2;
+uint16_t gTransientThresholdA = 0;
+uint16_t gTransientDurationMs = 100;
+uint16_t gLowVoltageAlarmmV = 0;
+uint16_t gHighVoltageAlarmmV = 0;
+uint16_t gRestCurrentmA = 200;
+uint16_t gRestTimeMin = 0;
+bool gUseLearnedCapacity = false;
+uint16_t gPeukertExponent = 105;
+uint16_t gTemperatureCoefficient = 5;
+bool gTtgFromProfile = false;
+bool gModbusEanbled = false;
+bool gVictronEanbled = true;
+
+char gVictronDevice[3] = "0";
+char gCustomName[64] = "INR SmartShunt native";
+
+// Nothing to store the configuration in
+void wifiSetVictronVals() {}
+void wifiStoreConfig() {}
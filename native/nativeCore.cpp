@@ -0,0 +1,264 @@
+#include <Arduino.h>
+#include <vector>
+
+// Virtual clock in microseconds since "power on"
+static uint64_t nowUs = 0;
+static std::vector<NativeTimed*> timedDevices;
+
+static const uint8_t NUM_PINS = 32;
+static void (*isrTable[NUM_PINS])(void);
+static bool pendingIrq[NUM_PINS];
+// Open drain outputs pulling a pin low
+static uint8_t pinPulls[NUM_PINS];
+static bool anyPendingIrq = false;
+static bool irqEnabled = true;
+static bool inIsr = false;
+static int criticalDepth = 0;
+
+static void deliverInterrupts() {
+    if (!anyPendingIrq || !irqEnabled || inIsr || criticalDepth > 0) {
+        return;
+    }
+    inIsr = true;
+    anyPendingIrq = false;
+    for (uint8_t pin = 0; pin < NUM_PINS; ++pin) {
+        if (pendingIrq[pin]) {
+            pendingIrq[pin] = false;
+            if (isrTable[pin]) {
+                isrTable[pin]();
+            }
+        }
+    }
+    inIsr = false;
+}
+
+void nativeAddTimed(NativeTimed* timed) { timedDevices.push_back(timed); }
+
+void nativeAdvanceMicros(uint64_t us) {
+    uint64_t target = nowUs + us;
+    while (true) {
+        uint64_t next = target;
+        for (NativeTimed* timed : timedDevices) {
+            uint64_t event = timed->nativeNextEvent();
+            if (event < next) {
+                next = event;
+            }
+        }
+        if (next > nowUs) {
+            nowUs = next;
+        }
+        for (NativeTimed* timed : timedDevices) {
+            if (timed->nativeNextEvent() <= nowUs) {
+                timed->nativeOnTime(nowUs);
+            }
+        }
+        deliverInterrupts();
+        if (nowUs >= target) {
+            break;
+        }
+    }
+}
+
+void nativeRaiseInterrupt(uint8_t pin) {
+    if (pin < NUM_PINS && isrTable[pin]) {
+        pendingIrq[pin] = true;
+        anyPendingIrq = true;
+    }
+}
+
+void nativePullLow(uint8_t pin, bool active) {
+    if (pin >= NUM_PINS) {
+        return;
+    }
+    if (active) {
+        if (pinPulls[pin]++ == 0) {
+            nativeRaiseInterrupt(pin);
+        }
+    } else if (pinPulls[pin] > 0) {
+        --pinPulls[pin];
+    }
+}
+
+void nativeEnterCritical() { ++criticalDepth; }
+
+void nativeLeaveCritical() {
+    if (--criticalDepth == 0) {
+        deliverInterrupts();
+    }
+}
+
+unsigned long millis() { return (unsigned long)(nowUs / 1000); }
+// Like on the target this wraps after ~71 minutes
+unsigned long micros() { return (uint32_t)nowUs; }
+uint64_t micros64() { return nowUs; }
+void delay(unsigned long ms) { nativeAdvanceMicros((uint64_t)ms * 1000); }
+void delayMicroseconds(unsigned int us) { nativeAdvanceMicros(us); }
+void yield() { deliverInterrupts(); }
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int) {
+    if (pin < NUM_PINS) {
+        isrTable[pin] = isr;
+    }
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < NUM_PINS) {
+        isrTable[pin] = 0;
+        pendingIrq[pin] = false;
+    }
+}
+
+void noInterrupts() { irqEnabled = false; }
+
+void interrupts() {
+    irqEnabled = true;
+    deliverInterrupts();
+}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t pin) { return (pin < NUM_PINS && pinPulls[pin]) ? LOW : HIGH; }
+
+// -- String
+void String::trim() {
+    size_t begin = str.find_first_not_of(" \t\r\n");
+    size_t end = str.find_last_not_of(" \t\r\n");
+    str = (begin == std::string::npos) ? std::string() : str.substr(begin, end - begin + 1);
+}
+
+void String::fromLong(long value, unsigned char base) {
+    if (base == 10) {
+        str = std::to_string(value);
+    } else {
+        fromULong((unsigned long)value, base);
+    }
+}
+
+void String::fromULong(unsigned long value, unsigned char base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = buf + sizeof(buf) - 1;
+    *p = 0;
+    do {
+        unsigned digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    str = p;
+}
+
+void String::fromDouble(double value, unsigned char decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    str = buf;
+}
+
+// -- Serial
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+
+int HardwareSerial::read() {
+    if (rxPos >= rx.size()) {
+        return -1;
+    }
+    int c = (uint8_t)rx[rxPos++];
+    if (rxPos == rx.size()) {
+        rx.clear();
+        rxPos = 0;
+    }
+    return c;
+}
+
+int HardwareSerial::peek() { return rxPos < rx.size() ? (uint8_t)rx[rxPos] : -1; }
+
+size_t HardwareSerial::readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length && available()) {
+        buffer[count++] = (char)read();
+    }
+    if (count < length) {
+        // The real implementation blocks until the timeout expires
+        delay(timeout);
+    }
+    return count;
+}
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+
+// Without a baud rate the writes take no time
+void HardwareSerial::drainTx() {
+    if (!baud_) {
+        txFifo = 0;
+        return;
+    }
+    uint64_t now = micros64();
+    uint64_t bytes = (now - txLastUs) * baud_ / 10000000;
+    if (bytes >= (uint64_t)txFifo) {
+        txFifo = 0;
+        txLastUs = now;
+    } else {
+        txFifo -= (int)bytes;
+        txLastUs += bytes * 10000000 / baud_;
+    }
+}
+
+int HardwareSerial::availableForWrite() {
+    drainTx();
+    return TX_FIFO - txFifo;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    // Like the cores, wait for room in the FIFO
+    for (size_t i = 0; i < size; ++i) {
+        drainTx();
+        while (txFifo >= TX_FIFO) {
+            uint64_t byteUs = (10000000 + baud_ - 1) / baud_;
+            nativeAdvanceMicros(byteUs);
+            txBlockedUs += byteUs;
+            drainTx();
+        }
+        ++txFifo;
+    }
+    if (sink) {
+        fwrite(buffer, 1, size, sink);
+    }
+    return size;
+}
+
+size_t HardwareSerial::printf(const char* format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0) {
+        return 0;
+    }
+    return write((const uint8_t*)buf, min((size_t)len, sizeof(buf) - 1));
+}
+
+void HardwareSerial::nativeInject(const char* data, size_t length) { rx.append(data, length); }
+
+// -- ESP
+EspClass ESP;
+
+// The ESP8266 offers 512 bytes of user RTC memory, addressed in 4 byte blocks
+static uint32_t rtcMemory[128];
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > sizeof(rtcMemory)) {
+        return false;
+    }
+    memcpy(data, rtcMemory + offset, size);
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > sizeof(rtcMemory)) {
+        return false;
+    }
+    memcpy(rtcMemory + offset, data, size);
+    return true;
+}
+
+// 80 MHz core clock, derived from virtual time
+uint32_t EspClass::getCycleCount() { return (uint32_t)(nowUs * 80); }
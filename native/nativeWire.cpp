@@ -0,0 +1,70 @@
+#include <Wire.h>
+
+TwoWire Wire;
+
+void TwoWire::nativeAttach(uint8_t address, NativeI2cDevice* device) { devices[address & 0x7F] = device; }
+
+void TwoWire::busTime(size_t bytes) {
+    // START, address byte, data bytes (9 clocks each incl. ACK) and STOP
+    uint64_t clocks = 2 + 9 * (1 + bytes);
+    uint64_t us = (clocks * 1000000 + clock - 1) / clock;
+    ++stats.transactions;
+    stats.bytes += bytes + 1;
+    stats.busTimeUs += us;
+    // The CPU spins while the transfer is running. Interrupts are held
+    // back until it is finished, the ISR must not see a half done transfer.
+    nativeEnterCritical();
+    nativeAdvanceMicros(us);
+    nativeLeaveCritical();
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    txAddress = address & 0x7F;
+    txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (txLength >= sizeof(txBuffer)) {
+        return 0;
+    }
+    txBuffer[txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t length) {
+    size_t written = 0;
+    while (written < length && write(data[written])) {
+        ++written;
+    }
+    return written;
+}
+
+uint8_t TwoWire::endTransmission(bool) {
+    NativeI2cDevice* device = devices[txAddress];
+    busTime(txLength);
+    if (!device) {
+        // NACK on address
+        return 2;
+    }
+    if (txLength) {
+        device->i2cWrite(txBuffer, txLength);
+    }
+    txLength = 0;
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool) {
+    NativeI2cDevice* device = devices[address & 0x7F];
+    rxIndex = 0;
+    rxLength = 0;
+    if (quantity > sizeof(rxBuffer)) {
+        quantity = sizeof(rxBuffer);
+    }
+    busTime(quantity);
+    if (!device) {
+        return 0;
+    }
+    device->i2cRead(rxBuffer, quantity);
+    rxLength = quantity;
+    return quantity;
+}
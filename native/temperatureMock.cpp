@@ -0,0 +1,6 @@
+#include "temperatureMock.h"
+
+TemperatureMock& nativeTemperature() {
+    static TemperatureMock mock;
+    return mock;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// Battery temperature for the native build, set by the tools
+
+#include "temperatureSource.h"
+
+class TemperatureMock : public TemperatureSource {
+public:
+    void set(float value) { celsius = value; }
+    // NAN makes the next reads fail like a disconnected sensor
+    bool read(float& value) override {
+        value = celsius;
+        return !isnan(celsius);
+    }
+
+private:
+    float celsius = NAN;
+};
+
+TemperatureMock& nativeTemperature();
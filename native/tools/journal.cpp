@@ -0,0 +1,141 @@
+// Benchmarks the flash state journal on the simulated NOR flash.
+//
+//   journal [--hours H] [--interval S] [--sectors N] [--cuts N]
+//
+// Runs a battery for the given time and appends its statistics every
+// interval, like statusJournalLoop() does. Reports the flash traffic
+// against writing a full copy of the statistics every time, the wear per
+// sector and the time a restore after a power loss takes. Then it cuts the
+// power at random points of an append and checks that the restore always
+// returns either the state before or the one after that append.
+
+#include <Arduino.h>
+#include <chrono>
+
+#include "common.h"
+#include "flashSim.h"
+#include "stateJournal.h"
+#include "statusHandling.h"
+
+// Runs the battery for one journal interval
+static void runInterval(BatteryStatus& battery, uint32_t intervalS, uint64_t& timeS) {
+    for (uint32_t i = 0; i < intervalS; ++i, ++timeS) {
+        double hour = fmod(timeS / 3600.0, 24.0);
+        float current = -6.0f + (hour > 7 && hour < 17 ? 35.0f * sin((hour - 7) / 10 * M_PI) : 0.0f);
+        battery.setVoltage(52.0f + current * 0.01f);
+        battery.updateConsumption(current, 1.0f, 1);
+        nativeAdvanceMicros(1000000);
+        battery.checkFull();
+        battery.updateSOC();
+        battery.updateTtG();
+        battery.updateStats(timeS * 1000);
+    }
+}
+
+static bool sameStats(const Statistics& a, const Statistics& b) { return !memcmp(&a, &b, sizeof(Statistics)); }
+
+int main(int argc, char** argv) {
+    double hours = 24 * 7;
+    uint32_t intervalS = 60;
+    uint32_t sectors = 64;
+    uint32_t cuts = 2000;
+
+    for (int i = 1; i < argc; ++i) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--hours") && more) {
+            hours = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--interval") && more) {
+            intervalS = max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--sectors") && more) {
+            sectors = max(2, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--cuts") && more) {
+            cuts = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--hours H] [--interval S] [--sectors N] [--cuts N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    NorFlashSim flash(sectors);
+    StateJournal journal(flash);
+    BatteryStatus battery;
+    Statistics lastWritten;
+    uint64_t timeS = 0;
+
+    battery.setParameters(gCapacityAh, gChargeEfficiencyPercent, gMinPercent, gTailCurrentmA, gFullVoltagemV,
+                          gFullDelayS);
+    battery.setBatterySoc(0.8f);
+    journal.begin();
+
+    uint32_t appends = 0;
+    for (; timeS < hours * 3600.0;) {
+        runInterval(battery, intervalS, timeS);
+        journal.append(0, battery.statistics());
+        memcpy((void*)&lastWritten, &battery.statistics(), sizeof(Statistics));
+        ++appends;
+    }
+
+    const NorFlashSim::Stats& stats = flash.stats();
+    double fullBytes = (double)appends * (4 + sizeof(Statistics));
+    uint32_t minErases = UINT32_MAX;
+    uint32_t maxErases = 0;
+    for (uint32_t s = 0; s < sectors; ++s) {
+        minErases = min(minErases, flash.eraseCount(s));
+        maxErases = max(maxErases, flash.eraseCount(s));
+    }
+    double erasesPerHour = stats.erases / hours;
+    printf("Journal of %.0f h, a record every %u s on %u sectors of %u bytes\n", hours, intervalS, sectors,
+           flash.sectorSize());
+    printf("appends:            %u (%u records written)\n", appends, journal.recordsWritten());
+    printf("bytes programmed:   %llu, %.1f per append (full copy: %u)\n", (unsigned long long)stats.bytesProgrammed,
+           stats.bytesProgrammed / (double)appends, (unsigned)(4 + sizeof(Statistics)));
+    printf("vs full copies:     %.2f\n", stats.bytesProgrammed / fullBytes);
+    printf("write amplification %.2f (programmed + erased bytes per changed byte of payload)\n",
+           (stats.bytesProgrammed + (double)stats.erases * flash.sectorSize()) / stats.bytesProgrammed);
+    printf("sector erases:      %u (per sector min %u, max %u)\n", stats.erases, minErases, maxErases);
+    if (erasesPerHour > 0) {
+        printf("100k cycle life:    %.0f years\n", 100000.0 * sectors / erasesPerHour / 24 / 365);
+    }
+    printf("flash busy:         %.3f s, %.2f ms per hour\n", stats.busyUs / 1e6, stats.busyUs / 1e3 / hours);
+
+    // Power loss: a new journal on the same flash
+    flash.resetStats();
+    Statistics restored;
+    StateJournal after(flash);
+    auto start = std::chrono::steady_clock::now();
+    bool found = after.begin() && after.restore(0, restored);
+    double hostUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("restore:            %s, %llu bytes read, %.2f ms on the flash, %.1f us on the host\n",
+           found && sameStats(restored, lastWritten) ? "ok" : "FAILED", (unsigned long long)flash.stats().bytesRead,
+           flash.stats().busyUs / 1e3, hostUs);
+
+    // Power cuts in the middle of an append
+    uint32_t seed = 1;
+    uint32_t failures = 0;
+    uint32_t broken = 0;
+    for (uint32_t i = 0; i < cuts; ++i) {
+        StateJournal writer(flash);
+        writer.begin();
+        Statistics before;
+        writer.restore(0, before);
+
+        runInterval(battery, intervalS, timeS);
+        seed = seed * 1103515245 + 12345;
+        // Mostly within the record, sometimes in the erase and the full
+        // records of a sector switch
+        flash.cutPowerAfter((seed >> 8) % (i & 1 ? 2 * flash.sectorSize() : 64));
+        bool written = writer.append(0, battery.statistics());
+        flash.powerOn();
+        broken += !written;
+
+        StateJournal reader(flash);
+        if (!reader.begin() || !reader.restore(0, restored) ||
+            !(sameStats(restored, before) || sameStats(restored, battery.statistics()))) {
+            ++failures;
+        }
+    }
+    if (cuts) {
+        printf("power cuts:         %u, %u of them during the append, %u bad restores\n", cuts, broken, failures);
+    }
+    return failures ? 1 : 0;
+}
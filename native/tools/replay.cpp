@@ -0,0 +1,306 @@
+// Replays recorded shunt traces through BatteryStatus as fast as possible.
+//
+//   replay <trace.csv> [--capacity AH] [--soc PERCENT] [--repeat N] [--offset A]
+//          [--rest MINUTES] [--learn]
+//   replay --synthetic HOURS [...]
+//
+// A trace is a text file with one sample per line:
+//
+//   <timestamp in ms>,<shunt current in A>,<bus voltage in V>[,<true SOC in %>]
+//
+// Lines starting with '#' are ignored. The current is positive while
+// charging, like the firmware expects it. The true SOC is optional, e.g.
+// from a BMS; the synthetic trace has it.
+//
+// The first pass runs the firmware code only (repeated N times) and reports
+// the cost per sample. The second pass runs it again next to a double
+// precision reference integration and reports how far remainAs and
+// consumedAs drifted, and how often checkFull() synchronised. With a true
+// SOC it also reports how far the firmware's SOC was off, which is what
+// compares the plain counter with SOC_EKF. --offset adds a current sensor
+// offset error the counter can't know about. --rest turns on the
+// synchronisation to the open circuit voltage after that long at rest,
+// --learn uses the learned capacity and efficiency.
+
+#include <Arduino.h>
+#include <chrono>
+#include <vector>
+
+#include "common.h"
+#include "statusHandling.h"
+#include "ocvCurve.h"
+
+struct TraceSample {
+    uint64_t timeMs;
+    float current;
+    float voltage;
+    float soc; // NAN if unknown
+};
+
+static bool loadTrace(const char* name, std::vector<TraceSample>& trace) {
+    FILE* file = fopen(name, "r");
+    if (!file) {
+        perror(name);
+        return false;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        double timeMs;
+        TraceSample sample;
+        if (line[0] == '#') {
+            continue;
+        }
+        int fields = sscanf(line, "%lf,%f,%f,%f", &timeMs, &sample.current, &sample.voltage, &sample.soc);
+        if (fields >= 3) {
+            sample.timeMs = (uint64_t)timeMs;
+            sample.soc = fields == 4 ? sample.soc / 100.0f : NAN;
+            trace.push_back(sample);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// A day of a solar powered system with a charger that goes into absorption
+// close to full, so checkFull() gets something to detect. The battery
+// follows the OCV curve of the build with an internal resistance and an RC
+// branch that differ a bit from what SOC_EKF assumes.
+static void syntheticTrace(double hours, std::vector<TraceSample>& trace) {
+    const double period = 0.270848;
+    const double capacityAs = gCapacityAh * 3600.0;
+    const double r0 = 0.012;
+    const double r1 = 0.008;
+    const double rcDecay = exp(-period / 90.0);
+    double remainAs = capacityAs * 0.6;
+    double rcVoltage = 0;
+    uint32_t seed = 1;
+
+    for (double t = 0; t < hours * 3600.0; t += period) {
+        double dayHour = fmod(t / 3600.0, 24.0);
+        double soc = remainAs / capacityAs;
+        double current = -6.0 + (fmod(t, 900.0) < 300.0 ? -5.0 : 0.0);
+        if (dayHour > 7.0 && dayHour < 17.0) {
+            current += 35.0 * sin((dayHour - 7.0) / 10.0 * M_PI);
+        }
+        if (current > 0 && soc > 0.97) {
+            // Absorption, the charger tapers the current
+            current = min(current, (1.0 - soc) * 600.0);
+        }
+        seed = seed * 1103515245 + 12345;
+        current += ((seed >> 16) & 0xFF) / 2560.0 - 0.05;
+
+        rcVoltage = rcDecay * rcVoltage + (1.0 - rcDecay) * r1 * current;
+        double voltage = ocvVoltage(soc) + rcVoltage + current * r0;
+        if (soc > 0.97 && current >= 0) {
+            voltage = gFullVoltagemV / 1000.0;
+        }
+        trace.push_back({(uint64_t)(t * 1000.0), (float)current, (float)voltage, (float)soc});
+        remainAs = constrain(remainAs + current * period, 0.0, capacityAs);
+    }
+}
+
+struct ReplayResult {
+    uint32_t syncs;
+    uint32_t restSyncs;
+    double maxRemainDrift;
+    double remainDrift;
+    double consumedDrift;
+    // Against the true SOC, in SOC units
+    uint32_t socSamples;
+    double socErrorSum;
+    double maxSocError;
+    double finalSocError;
+};
+
+// Feeds the trace into battery the same way sensorLoop() does. If result is
+// given, a reference integration runs alongside.
+static void replay(BatteryStatus& battery, const std::vector<TraceSample>& trace, float startSoc, float offset,
+                   ReplayResult* result) {
+    const double capacityAs = gCapacityAh * 3600.0;
+    const double efficiency = gChargeEfficiencyPercent / 100.0;
+    uint64_t lastUpdate = trace.front().timeMs;
+    uint64_t lastTime = trace.front().timeMs;
+    double lastCurrent = trace.front().current;
+    double refRemain = 0;
+    double refConsumed = 0;
+
+    // Each run starts from scratch, not with what the last one left in the
+    // RTC memory
+    Statistics fresh;
+    fresh.init();
+    battery.restoreStatistics(fresh);
+    battery.setParameters(gCapacityAh, gChargeEfficiencyPercent, gMinPercent, gTailCurrentmA, gFullVoltagemV,
+                          gFullDelayS);
+    battery.setRest(gRestCurrentmA, gRestTimeMin);
+    battery.setLearning(gUseLearnedCapacity);
+    battery.setBatterySoc(startSoc);
+    if (result) {
+        *result = ReplayResult();
+        refRemain = battery.statistics().remainAs;
+        refConsumed = battery.statistics().consumedAs;
+    }
+
+    for (const TraceSample& sample : trace) {
+        float period = (sample.timeMs - lastTime) / 1000.0f;
+        nativeAdvanceMicros((sample.timeMs - lastTime) * 1000);
+        lastTime = sample.timeMs;
+
+        float current = sample.current + offset;
+        battery.setVoltage(sample.voltage);
+        battery.updateConsumption(current, period, 1);
+
+        if (result) {
+            double charge = (lastCurrent + current) / 2.0 * period;
+            lastCurrent = current;
+            if (charge > 0) {
+                charge *= efficiency;
+            }
+            refRemain = constrain(refRemain + charge, 0.0, capacityAs);
+            refConsumed += charge;
+        }
+
+        if (sample.timeMs - lastUpdate >= UPDATE_INTERVAL) {
+            if (result) {
+                // With BATTERY_FIXED_POINT the float values are refreshed here
+                battery.updateSOC();
+                double drift = fabs(battery.statistics().remainAs - refRemain);
+                if (drift > result->maxRemainDrift) {
+                    result->maxRemainDrift = drift;
+                }
+            }
+            float remainBefore = battery.statistics().remainAs;
+            bool synced = battery.checkFull();
+            bool restSynced = battery.checkRest();
+            battery.updateSOC();
+            battery.updateTtG();
+            battery.updateStats(sample.timeMs);
+            lastUpdate = sample.timeMs;
+
+            if (result) {
+                // SOC corrections are policy, not numerics. Let the
+                // reference follow them.
+                if (battery.statistics().remainAs != remainBefore) {
+                    refRemain = battery.statistics().remainAs;
+                }
+                if (synced) {
+                    ++result->syncs;
+                    refConsumed = 0;
+                }
+                if (restSynced) {
+                    ++result->restSyncs;
+                }
+                if (!isnan(sample.soc)) {
+                    double error = fabs(battery.soc() - sample.soc);
+                    result->socErrorSum += error;
+                    result->maxSocError = max(result->maxSocError, error);
+                    result->finalSocError = battery.soc() - sample.soc;
+                    ++result->socSamples;
+                }
+            }
+        }
+    }
+
+    if (result) {
+        battery.updateSOC();
+        result->remainDrift = battery.statistics().remainAs - refRemain;
+        result->consumedDrift = battery.statistics().consumedAs - refConsumed;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<TraceSample> trace;
+    const char* traceName = 0;
+    double synthetic = 0;
+    float startSoc = 80;
+    float offset = 0;
+    int repeat = 10;
+
+    for (int i = 1; i < argc; ++i) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--synthetic") && more) {
+            synthetic = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--capacity") && more) {
+            gCapacityAh = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--soc") && more) {
+            startSoc = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--offset") && more) {
+            offset = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--rest") && more) {
+            gRestTimeMin = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--learn")) {
+            gUseLearnedCapacity = true;
+        } else if (!strcmp(argv[i], "--repeat") && more) {
+            repeat = max(1, atoi(argv[++i]));
+        } else if (argv[i][0] != '-') {
+            traceName = argv[i];
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (traceName) {
+        if (!loadTrace(traceName, trace)) {
+            return 1;
+        }
+    } else if (synthetic > 0) {
+        syntheticTrace(synthetic, trace);
+    } else {
+        fprintf(stderr,
+                "usage: %s <trace.csv> | --synthetic HOURS [--capacity AH] [--soc PERCENT] [--repeat N] [--offset A] [--rest MIN] [--learn]\n",
+                argv[0]);
+        return 1;
+    }
+    if (trace.size() < 2) {
+        fprintf(stderr, "Trace too short\n");
+        return 1;
+    }
+
+    // Pass 1: timing
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; ++i) {
+        BatteryStatus battery;
+        replay(battery, trace, startSoc / 100.0f, offset, 0);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / ((double)trace.size() * repeat);
+
+    // Pass 2: accuracy
+    BatteryStatus battery;
+    ReplayResult result;
+    replay(battery, trace, startSoc / 100.0f, offset, &result);
+
+    double hours = (trace.back().timeMs - trace.front().timeMs) / 3600000.0;
+#ifdef BATTERY_FIXED_POINT
+    printf("accumulator:      fixed point\n");
+#else
+    printf("accumulator:      float\n");
+#endif
+#ifdef SOC_EKF
+    printf("soc:              EKF\n");
+#else
+    printf("soc:              counter\n");
+#endif
+    printf("samples:          %zu (%.1f h)\n", trace.size(), hours);
+    printf("cost:             %.1f ns/sample\n", ns);
+#ifdef SOC_EKF
+    // The filter moves remainAs on purpose, the reference can't follow
+    printf("remainAs drift:   n/a with SOC_EKF\n");
+#else
+    printf("remainAs drift:   %+.3f As (max %.3f As)\n", result.remainDrift, result.maxRemainDrift);
+#endif
+    printf("consumedAs drift: %+.3f As\n", result.consumedDrift);
+    printf("checkFull syncs:  %u\n", result.syncs);
+    printf("rest syncs:       %u\n", result.restSyncs);
+    printf("final soc:        %.2f %%\n", battery.soc() * 100.0f);
+    const CapacityLearner& learner = battery.capacityLearner();
+    printf("learned:          %.1f Ah (%u samples), efficiency %.1f %% (%u samples)\n",
+           learner.capacityAs() / 3600.0f, learner.capacitySamples(), learner.efficiency() * 100.0f,
+           learner.efficiencySamples());
+    if (result.socSamples) {
+        printf("soc error:        mean %.2f %%, max %.2f %%, final %+.2f %%\n",
+               result.socErrorSum / result.socSamples * 100.0, result.maxSocError * 100.0,
+               result.finalSocError * 100.0);
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+// Runs the firmware acquisition pipeline against a simulated INA226.
+//
+//   simulate [--hours H] [--loop-us US] [--stall-ms MS] [--stall-every S]
+//            [--clock-error F] [--soc PERCENT] [--vedirect] [--transient A]
+//            [--temperature C] [--peukert K] [--profile] [--hex]
+//
+// The load profile is a house battery: a constant base load, a fridge
+// compressor cycling every 15 minutes, an inverter inrush once per hour and
+// solar charging during the day. The tool integrates the true current in
+// double precision and compares it against what the firmware counted.
+// With MAX_SENSORS > 1 every sensor sees the same current (parallel
+// strings of the same size), but each chip gets a slightly different clock,
+// so the conversions drift apart on the shared ALERT line.
+// --temperature feeds the mocked battery temperature, --peukert sets the
+// exponent for the time to go in 0.01, --profile predicts it from the
+// daily load profile. --hex starts with a HEX ping like a GX device does,
+// after that the changed registers are pushed as async messages.
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <vector>
+
+#include "common.h"
+#include "sensorHandling.h"
+#include "statusHandling.h"
+#include "historyHandling.h"
+#include "victronHandling.h"
+#include "ocvCurve.h"
+#include "../ina226Sim.h"
+#include "../temperatureMock.h"
+
+static const double HOUR_US = 3600.0e6;
+
+static float loadCurrent(uint64_t us) {
+    double t = us / 1.0e6;
+    double dayHour = fmod(t / 3600.0, 24.0);
+    double current = -4.0;
+
+    // Fridge compressor: 5 minutes on every 15 minutes
+    if (fmod(t, 900.0) < 300.0) {
+        current -= 6.0;
+    }
+    // Inverter inrush at the start of every hour
+    double inHour = fmod(t, 3600.0);
+    if (inHour >= 10.0 && inHour < 10.2) {
+        current -= 80.0;
+    }
+    // Solar from 8 to 18 o'clock
+    if (dayHour > 8.0 && dayHour < 18.0) {
+        current += 25.0 * sin((dayHour - 8.0) / 10.0 * M_PI);
+    }
+    return (float)current;
+}
+
+static double refRemainAs = 0;
+// Polarisation, an RC branch of 8mOhm and 90s
+static double rcVoltage = 0;
+static double capacityAs = 0;
+
+static float batteryVoltage(uint64_t us) {
+    // The OCV curve of the build (16S LiFePO4 by default), the charge knee
+    // above 95%, polarisation and internal resistance
+    double soc = refRemainAs / capacityAs;
+    double ocv = ocvVoltage(soc) + (soc > 0.95 ? (soc - 0.95) * 40.0 : 0.0) + rcVoltage;
+    return (float)(ocv + loadCurrent(us) * 0.01);
+}
+
+int main(int argc, char** argv) {
+    double hours = 24;
+    uint32_t loopUs = 2000;
+    uint32_t stallMs = 0;
+    uint32_t stallEveryS = 10;
+    float clockError = 1.0f;
+    float startSoc = 80;
+    bool vedirect = false;
+    bool hex = false;
+
+    for (int i = 1; i < argc; ++i) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--hours") && more) {
+            hours = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--loop-us") && more) {
+            loopUs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--stall-ms") && more) {
+            stallMs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--stall-every") && more) {
+            stallEveryS = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--clock-error") && more) {
+            clockError = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--soc") && more) {
+            startSoc = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--transient") && more) {
+            gTransientThresholdA = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--temperature") && more) {
+            nativeTemperature().set(atof(argv[++i]));
+            temperatureSetSource(&nativeTemperature());
+        } else if (!strcmp(argv[i], "--peukert") && more) {
+            gPeukertExponent = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--profile")) {
+            gTtgFromProfile = true;
+        } else if (!strcmp(argv[i], "--vedirect")) {
+            vedirect = true;
+        } else if (!strcmp(argv[i], "--hex")) {
+            hex = true;
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    capacityAs = gCapacityAh * 3600.0;
+    refRemainAs = capacityAs * startSoc / 100.0;
+
+    static const uint8_t addresses[] = {0x40, 0x41, 0x44, 0x45};
+    std::vector<Ina226Sim*> chips;
+    for (uint8_t i = 0; i < NUM_SENSORS; ++i) {
+        Ina226Sim* chip = new Ina226Sim(D5, gShuntResistancemR / 1000.0f);
+        chip->setCurrentSource(loadCurrent);
+        chip->setBusSource([](uint64_t us) { return batteryVoltage(us) / gVoltageCalibrationFactor; });
+        chip->setNoise(0.0000025f, 0.0005f);
+        chip->setClockError(clockError * (1.0f + 0.007f * i));
+        Wire.nativeAttach(addresses[i], chip);
+        nativeAddTimed(chip);
+        chips.push_back(chip);
+    }
+    const Ina226Sim& chip = *chips[0];
+
+    if (vedirect) {
+        Serial.nativeSetSink(stdout);
+    }
+
+    sensorInit();
+    victronInit();
+    for (BatteryStatus& battery : gBatteries) {
+        battery.setBatterySoc(startSoc / 100.0f);
+    }
+    gParamsChanged = false;
+    if (hex) {
+        static const char ping[] = ":154\n";
+        Serial.nativeInject(ping, sizeof(ping) - 1);
+    }
+
+    uint64_t end = (uint64_t)(hours * HOUR_US);
+    uint64_t nextReport = (uint64_t)HOUR_US;
+    uint64_t nextStall = (uint64_t)stallEveryS * 1000000;
+    uint64_t loops = 0;
+    double efficiency = gChargeEfficiencyPercent / 100.0;
+
+    while (micros64() < end) {
+        uint64_t before = micros64();
+        sensorLoop();
+        victronLoop();
+        if (stallMs && before >= nextStall) {
+            // Something like handleRoot() or an OTA check blocking the loop
+            delay(stallMs);
+            nextStall += (uint64_t)stallEveryS * 1000000;
+        }
+        nativeAdvanceMicros(loopUs);
+        ++loops;
+
+        // Reference integration of the true current
+        uint64_t now = micros64();
+        double step = (now - before) / 1.0e6;
+        double current = (loadCurrent(before) + loadCurrent(now)) / 2.0;
+        refRemainAs += current * step * (current > 0 ? efficiency : 1.0);
+        refRemainAs = constrain(refRemainAs, 0.0, capacityAs);
+        double decay = exp(-step / 90.0);
+        rcVoltage = decay * rcVoltage + (1.0 - decay) * 0.008 * current;
+
+        if (now >= nextReport) {
+            const Statistics& stats = gBattery.statistics();
+            fprintf(stderr, "%6.1fh  soc %6.2f%% (ref %6.2f%%)  remain %9.1f As (ref %9.1f As)  ttg %8.0f s  conversions %u\n",
+                    now / HOUR_US, gBattery.soc() * 100.0f, refRemainAs / capacityAs * 100.0, stats.remainAs,
+                    refRemainAs, gBattery.tTg(), chip.conversions());
+            nextReport += (uint64_t)HOUR_US;
+        }
+    }
+
+    fprintf(stderr, "\nSimulated %.1f h in %llu loop passes\n", micros64() / HOUR_US, (unsigned long long)loops);
+    for (uint8_t i = 0; i < NUM_SENSORS; ++i) {
+        fprintf(stderr, "INA226 0x%02x conversions: %u\n", addresses[i], chips[i]->conversions());
+    }
+    fprintf(stderr, "I2C transactions: %u (%llu us on the bus)\n", Wire.nativeStats().transactions,
+            (unsigned long long)Wire.nativeStats().busTimeUs);
+    fprintf(stderr, "Loop stall max: %.1f ms, waited %.1f ms for the UART\n", sensorLoopStallMaxUs() / 1000.0,
+            Serial.nativeTxBlockedUs() / 1000.0);
+    const TransientHeader& transient = sensorTransientHeader();
+    if (transient.count) {
+        const TransientPoint* points = sensorTransientPoints();
+        float peak = 0;
+        for (uint16_t i = transient.trigger; i < transient.count; ++i) {
+            peak = max(peak, fabsf(points[i].shunt * transient.currentLsb));
+        }
+        fprintf(stderr, "Last transient: %u points (%u before the trigger) over %.1f ms, peak %.1f A\n",
+                transient.count, transient.trigger,
+                (points[transient.count - 1].timeUs - points[transient.trigger].timeUs) / 1000.0, peak);
+    }
+    HistoryStore* history = historyStore();
+    if (history && history->pointsWritten()) {
+        fprintf(stderr, "History: %u minutes in %u bytes (%.1f bytes per minute)\n", history->pointsWritten(),
+                history->bytesWritten(), (float)history->bytesWritten() / history->pointsWritten());
+    }
+    const RollupPyramid& rollup = historyRollup();
+    static const char* const levelNames[RollupPyramid::NUM_LEVELS] = {"s", "min", "h", "d"};
+    for (uint8_t l = 0; l < RollupPyramid::NUM_LEVELS; ++l) {
+        RollupPyramid::Level level = (RollupPyramid::Level)l;
+        float energy = 0;
+        int32_t minmA = INT32_MAX, maxmA = INT32_MIN;
+        for (uint16_t i = 0; i < rollup.count(level); ++i) {
+            energy += rollup.point(level, i).energyWh;
+            minmA = min(minmA, rollup.point(level, i).minmA);
+            maxmA = max(maxmA, rollup.point(level, i).maxmA);
+        }
+        if (rollup.count(level)) {
+            fprintf(stderr, "Rollup %-3s: %3u points, %9.1f Wh, %7.2f .. %7.2f A\n", levelNames[l], rollup.count(level),
+                    energy, minmA * 0.001f, maxmA * 0.001f);
+        }
+    }
+    for (uint8_t i = 0; i < NUM_SENSORS; ++i) {
+        const Statistics& stats = gBatteries[i].statistics();
+        fprintf(stderr, "Remaining charge 0x%02x: %.1f As, reference %.1f As, error %.1f As\n", addresses[i],
+                stats.remainAs, refRemainAs, stats.remainAs - refRemainAs);
+        fprintf(stderr, "Cycles 0x%02x: %u charge cycles, %u full discharges, discharge last %d mAh average %d mAh "
+                        "deepest %d mAh\n", addresses[i], stats.numChargeCycles, stats.numFullDischarge,
+                stats.lastDischarge, stats.averageDischarge, stats.deepestDischarge);
+    }
+    return 0;
+}
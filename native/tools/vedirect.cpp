@@ -0,0 +1,124 @@
+// Benchmarks building the VE.Direct text frames.
+//
+//   vedirect [--frames N]
+//
+// Builds the small block and the history block of a running battery over
+// and over and reports the time and the heap allocations per frame, then
+// does the same for HEX GETs of the SOC and a history register. Last it
+// feeds a stream of HEX commands through the parser for its throughput. The
+// allocations are counted with a replaced global operator new, which is
+// where the String of the native shim ends up.
+
+#include <Arduino.h>
+#include <chrono>
+#include <new>
+
+#include "common.h"
+#include "hexParser.h"
+#include "hexRegisters.h"
+#include "statusHandling.h"
+#include "victronHandling.h"
+
+static uint64_t numAllocations = 0;
+
+void* operator new(size_t size) {
+    ++numAllocations;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+static void measure(const char* name, const VeDirectFrame& (*build)(), uint32_t frames) {
+    uint64_t allocations = numAllocations;
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < frames; ++i) {
+        bytes = build().size();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    allocations = numAllocations - allocations;
+    printf("%-14s %4u bytes  %7.0f ns/frame  %.2f heap allocations/frame\n", name, (unsigned)bytes, ns / frames,
+           (double)allocations / frames);
+}
+
+static void measureGet(uint16_t id, uint32_t frames) {
+    uint8_t value[HEX_MAX_VALUE];
+    uint8_t size = 0;
+    uint64_t allocations = numAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; ++i) {
+        hexRegisterGet(id, value, size);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    allocations = numAllocations - allocations;
+    printf("GET 0x%04X     %4u bytes  %7.0f ns/get    %.2f heap allocations/get\n", id, size, ns / frames,
+           (double)allocations / frames);
+}
+
+static void measureParser(uint32_t frames) {
+    // GETs as a GX device polls them, every 8th ends in \r\n and every 16th
+    // has a bad checksum
+    static const uint16_t ids[] = {0x0FFF, 0xED8D, 0xED8F, 0xEEFF, 0x0FFE, 0x0300, 0x1000, 0x010C};
+    std::string stream;
+    uint32_t numCommands = 0;
+    for (uint32_t i = 0; i < 1024; ++i) {
+        uint16_t id = ids[i % 8];
+        uint8_t checksum = 0x55 - 7 - (id & 0xFF) - (id >> 8) + (i % 16 == 15 ? 1 : 0);
+        char command[16];
+        snprintf(command, sizeof(command), ":7%02X%02X00%02X%s", id & 0xFF, id >> 8, checksum, i % 8 == 7 ? "\r\n" : "\n");
+        stream += command;
+        numCommands += i % 16 != 15;
+    }
+
+    HexParser parser;
+    uint32_t complete = 0;
+    uint64_t allocations = numAllocations;
+    uint32_t rounds = max(frames / 1024, 1u);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < rounds; ++round) {
+        for (char c : stream) {
+            complete += parser.feed(c) == HexParser::COMPLETE;
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    allocations = numAllocations - allocations;
+    printf("HEX parser     %u of %u commands, %u errors, %.1f ns/byte, %.0f ns/command, %.2f heap allocations/command\n",
+           complete, numCommands * rounds, parser.errors(), ns / (stream.size() * rounds), ns / (1024.0 * rounds),
+           (double)allocations / (1024.0 * rounds));
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = 100000;
+
+    for (int i = 1; i < argc; ++i) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--frames") && more) {
+            frames = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // A battery halfway through a discharge, so every field has digits
+    for (uint32_t s = 0; s < 3600; ++s) {
+        gBattery.setVoltage(52.3f);
+        gBattery.updateConsumption(-12.5f, 1.0f, 1);
+        nativeAdvanceMicros(1000000);
+        gBattery.updateSOC();
+        gBattery.updateTtG();
+        gBattery.updateStats(s * 1000);
+    }
+
+    measure("small block", victronSmallBlock, frames);
+    measure("history block", victronHistoryBlock, frames);
+    measureGet(0x0FFF, frames);
+    measureGet(0x0305, frames);
+    measureParser(frames);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "capacityLearner.h"
+
+// A rest point is only good for a few % SOC, capacity samples need a span
+// that makes that small
+static const float MIN_CAPACITY_SPAN = 0.4f;
+// Efficiency samples need points this close and at least this much charge
+// (in capacities) in between
+static const float MAX_EFFICIENCY_SPAN = 0.02f;
+static const float MIN_EFFICIENCY_CHARGE = 0.3f;
+// Samples outside these bounds are measurement errors, not aging
+static const float MIN_CAPACITY = 0.5f;
+static const float MAX_CAPACITY = 1.25f;
+static const float MIN_EFFICIENCY = 0.6f;
+static const float MAX_EFFICIENCY = 1.0f;
+// Weight of a new sample once the mean has enough of them
+static const float LEARN_GAIN = 0.2f;
+
+static void addSample(float& value, uint8_t& count, float sample) {
+    if (count < UINT8_MAX) {
+        ++count;
+    }
+    value += (sample - value) * max(1.0f / count, LEARN_GAIN);
+}
+
+void CapacityLearner::addCharge(uint32_t in, uint32_t out) {
+    inmAh += in;
+    outmAh += out;
+}
+
+bool CapacityLearner::syncPoint(float soc, float nominalCapacityAs, float nominalEfficiency) {
+    bool learned = false;
+
+    if (havePoint) {
+        float capacity = learnedCapacityAs > 0 ? learnedCapacityAs : nominalCapacityAs;
+        float efficiency = learnedEfficiency > 0 ? learnedEfficiency : nominalEfficiency;
+        float inAs = inmAh * 3.6f;
+        float outAs = outmAh * 3.6f;
+        float span = soc - pointSoc;
+
+        if (fabsf(span) >= MIN_CAPACITY_SPAN) {
+            float sample = (efficiency * inAs - outAs) / span;
+            if (sample >= nominalCapacityAs * MIN_CAPACITY && sample <= nominalCapacityAs * MAX_CAPACITY) {
+                addSample(learnedCapacityAs, numCapacity, sample);
+                learned = true;
+            }
+        } else if (fabsf(span) <= MAX_EFFICIENCY_SPAN && inAs >= capacity * MIN_EFFICIENCY_CHARGE) {
+            float sample = (outAs + capacity * span) / inAs;
+            if (sample >= MIN_EFFICIENCY && sample <= MAX_EFFICIENCY) {
+                addSample(learnedEfficiency, numEfficiency, sample);
+                learned = true;
+            }
+        }
+    }
+
+    pointSoc = soc;
+    inmAh = outmAh = 0;
+    havePoint = 1;
+    return learned;
+}
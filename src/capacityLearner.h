@@ -0,0 +1,39 @@
+#pragma once
+
+// Learns the usable capacity and the charge efficiency of the battery from
+// the charge that went in and out between two points where the SOC is
+// known, i.e. full syncs and syncs to the resting voltage:
+//
+//   capacity * (socB - socA) = efficiency * in - out
+//
+// Between points far enough apart in SOC that gives the capacity, between
+// two points at about the same SOC (usually full to full) the efficiency.
+// Each result goes into a mean that turns into an exponential one after a
+// few samples, so old values fade as the battery ages and a few words hold
+// everything. It is part of Statistics and survives resets with it.
+
+#include <Arduino.h>
+
+struct CapacityLearner {
+    // Charge through the shunt since the last point, without efficiency
+    void addCharge(uint32_t inmAh, uint32_t outmAh);
+    // Called at a point where the SOC is known. Learns from the charge
+    // since the previous one; true if capacity or efficiency changed.
+    bool syncPoint(float soc, float nominalCapacityAs, float nominalEfficiency);
+
+    // Both 0 while nothing was learned
+    float capacityAs() const { return learnedCapacityAs; }
+    float efficiency() const { return learnedEfficiency; }
+    uint8_t capacitySamples() const { return numCapacity; }
+    uint8_t efficiencySamples() const { return numEfficiency; }
+
+    // Zeroed by Statistics::init(), that is a learner without any point
+    float pointSoc;
+    uint32_t inmAh;
+    uint32_t outmAh;
+    float learnedCapacityAs;
+    float learnedEfficiency;
+    uint8_t havePoint;
+    uint8_t numCapacity;
+    uint8_t numEfficiency;
+};
@@ -20,6 +20,16 @@ extern float gVoltageCalibrationFactor;
 extern float gCurrentCalibrationFactor;
 extern uint16_t gMaxCurrentA;
 extern uint16_t gModbusId;
+extern uint16_t gTransientThresholdA;
+extern uint16_t gTransientDurationMs;
+extern uint16_t gLowVoltageAlarmmV;
+extern uint16_t gHighVoltageAlarmmV;
+extern uint16_t gRestCurrentmA;
+extern uint16_t gRestTimeMin;
+extern bool gUseLearnedCapacity;
+extern uint16_t gPeukertExponent;
+extern uint16_t gTemperatureCoefficient;
+extern bool gTtgFromProfile;
 extern bool gSensorInitialized;
 extern bool gModbusEanbled;
 extern bool gVictronEanbled;
@@ -29,15 +39,16 @@ extern char gCustomName[64];
 
 #define UPDATE_INTERVAL 990
 
-// How many ensors can we handle...
-#ifdef MAX_SENSORS 
-#if (MAX_SENSORS > SOC_UART_NUM)
-#define NUM_SENSORS SOC_UART_NUM
-#else
-#define NUM_SENSORS MAX_SENSORS
+// How many sensors can we handle...
+// They all sit on the same I2C bus and share the ALERT line, every one
+// feeds its own BatteryStatus. VE.Direct and Modbus report the first one.
+#ifdef MAX_SENSORS
+#if (MAX_SENSORS > 4)
+#error "At most 4 INA226 are supported"
 #endif
+#define NUM_SENSORS MAX_SENSORS
 #else
-#define NUM_SENSORS SOC_UART_NUM
+#define NUM_SENSORS 1
 #endif
 
 
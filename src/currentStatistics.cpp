@@ -0,0 +1,103 @@
+#include "currentStatistics.h"
+
+static const uint32_t HORIZON_MS[CurrentStatistics::NUM_HORIZONS] = {60000UL, 900000UL, 3600000UL};
+static const int64_t NAS_PER_MAS = 1000000;
+
+CurrentStatistics::CurrentStatistics() {
+    memset(windows, 0, sizeof(windows));
+    for (uint8_t i = 0; i < NUM_HORIZONS; ++i) {
+        Window& window = windows[i];
+        window.bucketUs = HORIZON_MS[i] / STATS_BUCKETS * 1000;
+        window.minmA = window.openMin = INT32_MAX;
+        window.maxmA = window.openMax = INT32_MIN;
+    }
+}
+
+void CurrentStatistics::add(float current, float duration) {
+    int32_t currentmA = lroundf(current * 1000.0f);
+    uint32_t durationUs = lroundf(duration * 1000000.0f);
+    for (Window& window : windows) {
+        add(window, currentmA, durationUs);
+    }
+}
+
+void CurrentStatistics::add(Window& window, int32_t currentmA, uint32_t durationUs) {
+    // Whatever is older than the horizon falls out anyway. This bounds the
+    // number of buckets a long gap can close.
+    uint32_t horizonUs = window.bucketUs * STATS_BUCKETS;
+    if (durationUs > horizonUs) {
+        durationUs = horizonUs;
+    }
+    if (currentmA < window.openMin) {
+        window.openMin = currentmA;
+    }
+    if (currentmA > window.openMax) {
+        window.openMax = currentmA;
+    }
+    while (durationUs > 0) {
+        uint32_t part = min(durationUs, window.bucketUs - window.openUs);
+        window.openCharge += (int64_t)currentmA * part;
+        window.openUs += part;
+        durationUs -= part;
+        if (window.openUs >= window.bucketUs) {
+            close(window);
+            if (durationUs > 0) {
+                window.openMin = window.openMax = currentmA;
+            }
+        }
+    }
+}
+
+void CurrentStatistics::close(Window& window) {
+    Bucket& bucket = window.buckets[window.next];
+    if (window.count == STATS_BUCKETS) {
+        window.chargemAs -= bucket.chargemAs;
+        window.durationMs -= bucket.durationMs;
+    } else {
+        ++window.count;
+    }
+
+    bucket.chargemAs = window.openCharge / NAS_PER_MAS;
+    bucket.durationMs = window.openUs / 1000;
+    bucket.minmA = window.openMin;
+    bucket.maxmA = window.openMax;
+    window.chargemAs += bucket.chargemAs;
+    window.durationMs += bucket.durationMs;
+    window.next = (window.next + 1) % STATS_BUCKETS;
+
+    // Once per bucket, not per sample
+    window.minmA = INT32_MAX;
+    window.maxmA = INT32_MIN;
+    for (uint8_t i = 0; i < window.count; ++i) {
+        window.minmA = min(window.minmA, window.buckets[i].minmA);
+        window.maxmA = max(window.maxmA, window.buckets[i].maxmA);
+    }
+
+    window.openCharge -= (int64_t)bucket.chargemAs * NAS_PER_MAS;
+    window.openUs = 0;
+    window.openMin = INT32_MAX;
+    window.openMax = INT32_MIN;
+}
+
+float CurrentStatistics::average(Horizon horizon) const {
+    const Window& window = windows[horizon];
+    uint64_t durationUs = (uint64_t)window.durationMs * 1000 + window.openUs;
+    if (durationUs == 0) {
+        return 0;
+    }
+    // nAs / us = mA
+    int64_t charge = window.chargemAs * NAS_PER_MAS + window.openCharge;
+    return (float)charge / durationUs / 1000.0f;
+}
+
+float CurrentStatistics::minimum(Horizon horizon) const {
+    const Window& window = windows[horizon];
+    int32_t value = min(window.minmA, window.openMin);
+    return value == INT32_MAX ? 0 : value / 1000.0f;
+}
+
+float CurrentStatistics::maximum(Horizon horizon) const {
+    const Window& window = windows[horizon];
+    int32_t value = max(window.maxmA, window.openMax);
+    return value == INT32_MIN ? 0 : value / 1000.0f;
+}
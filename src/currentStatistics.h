@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Time weighted average, minimum and maximum of the battery current over
+// several sliding horizons. Every horizon is split into STATS_BUCKETS
+// buckets; a sample only touches the open bucket of each horizon, the
+// window sums are updated when a bucket closes. All sums are integers
+// (mA, ms, nAs), so adding and removing a bucket leaves no rounding error
+// behind no matter how long the system runs.
+class CurrentStatistics {
+public:
+    enum Horizon { HORIZON_1MIN = 0, HORIZON_15MIN, HORIZON_1H, NUM_HORIZONS };
+
+    CurrentStatistics();
+
+    // current in A, held for duration s
+    void add(float current, float duration);
+
+    bool empty() const { return windows[HORIZON_1MIN].count == 0 && windows[HORIZON_1MIN].openUs == 0; }
+    // All in A, 0 if nothing was added yet
+    float average(Horizon horizon) const;
+    float minimum(Horizon horizon) const;
+    float maximum(Horizon horizon) const;
+
+private:
+    static const uint8_t STATS_BUCKETS = 20;
+
+    struct Bucket {
+        int32_t chargemAs;
+        uint32_t durationMs;
+        int32_t minmA;
+        int32_t maxmA;
+    };
+
+    struct Window {
+        uint32_t bucketUs;
+        Bucket buckets[STATS_BUCKETS];
+        // Bucket that is overwritten next, i.e. the oldest one once full
+        uint8_t next;
+        uint8_t count;
+        // Sums over the closed buckets
+        int64_t chargemAs;
+        uint32_t durationMs;
+        int32_t minmA;
+        int32_t maxmA;
+        // The bucket being filled. The charge keeps what didn't make a
+        // full mAs when the last bucket closed.
+        int64_t openCharge; // nAs
+        uint32_t openUs;
+        int32_t openMin;
+        int32_t openMax;
+    };
+
+    void add(Window& window, int32_t currentmA, uint32_t durationUs);
+    void close(Window& window);
+
+    Window windows[NUM_HORIZONS];
+};
@@ -0,0 +1,89 @@
+#include "flashRegion.h"
+
+#ifndef JOURNAL_SECTORS
+// A sector lasts about two hours of journal, so every one of them gets
+// erased three times a day.
+#define JOURNAL_SECTORS 4
+#endif
+// The history needs at least two sectors as well
+static const uint32_t MIN_HISTORY_SECTORS = 2;
+
+static uint32_t dataSectors() {
+    FlashRegion* data = flashDataRegion();
+    return data ? data->size() / data->sectorSize() : 0;
+}
+
+FlashRegion* flashJournalRegion() {
+    static FlashSubRegion* region = 0;
+    if (!region && dataSectors() >= JOURNAL_SECTORS + MIN_HISTORY_SECTORS) {
+        region = new FlashSubRegion(*flashDataRegion(), 0, JOURNAL_SECTORS);
+    }
+    return region;
+}
+
+FlashRegion* flashHistoryRegion() {
+    static FlashSubRegion* region = 0;
+    if (!region && dataSectors() >= JOURNAL_SECTORS + MIN_HISTORY_SECTORS) {
+        region = new FlashSubRegion(*flashDataRegion(), JOURNAL_SECTORS, dataSectors() - JOURNAL_SECTORS);
+    }
+    return region;
+}
+
+#if defined(ESP32)
+#include <esp_partition.h>
+
+class PartitionRegion : public FlashRegion {
+public:
+    PartitionRegion(const esp_partition_t* partition) : partition(partition) {}
+
+    uint32_t size() const override { return partition->size; }
+
+    bool read(uint32_t address, uint32_t* data, size_t size) override {
+        return esp_partition_read(partition, address, data, size) == ESP_OK;
+    }
+    bool write(uint32_t address, const uint32_t* data, size_t size) override {
+        return esp_partition_write(partition, address, data, size) == ESP_OK;
+    }
+    bool eraseSector(uint32_t sector) override {
+        return esp_partition_erase_range(partition, sector * sectorSize(), sectorSize()) == ESP_OK;
+    }
+
+private:
+    const esp_partition_t* partition;
+};
+
+FlashRegion* flashDataRegion() {
+    static PartitionRegion* region = 0;
+    if (!region) {
+        const esp_partition_t* partition =
+            esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+        if (partition) {
+            region = new PartitionRegion(partition);
+        }
+    }
+    return region;
+}
+
+#elif defined(ESP8266)
+#include <flash_hal.h>
+
+class FsAreaRegion : public FlashRegion {
+public:
+    uint32_t size() const override { return FS_PHYS_SIZE; }
+
+    bool read(uint32_t address, uint32_t* data, size_t size) override {
+        return ESP.flashRead(FS_PHYS_ADDR + address, data, size);
+    }
+    bool write(uint32_t address, const uint32_t* data, size_t size) override {
+        return ESP.flashWrite(FS_PHYS_ADDR + address, data, size);
+    }
+    bool eraseSector(uint32_t sector) override {
+        return ESP.flashEraseSector(FS_PHYS_ADDR / FLASH_SECTOR_SIZE + sector);
+    }
+};
+
+FlashRegion* flashDataRegion() {
+    static FsAreaRegion region;
+    return FS_PHYS_SIZE ? &region : 0;
+}
+#endif
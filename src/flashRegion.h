@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+
+// A piece of raw NOR flash. Erasing a sector sets all its bits, writing
+// can only clear bits. Addresses are relative to the start of the region,
+// addresses and sizes have to be multiples of 4.
+class FlashRegion {
+public:
+    virtual ~FlashRegion() {}
+
+    virtual uint32_t size() const = 0;
+    virtual uint32_t sectorSize() const { return 4096; }
+
+    virtual bool read(uint32_t address, uint32_t* data, size_t size) = 0;
+    virtual bool write(uint32_t address, const uint32_t* data, size_t size) = 0;
+    virtual bool eraseSector(uint32_t sector) = 0;
+};
+
+// A part of another region, starting at a sector boundary
+class FlashSubRegion : public FlashRegion {
+public:
+    FlashSubRegion(FlashRegion& parent, uint32_t firstSector, uint32_t numSectors)
+        : parent(parent), start(firstSector * parent.sectorSize()), length(numSectors * parent.sectorSize()),
+          firstSector(firstSector) {}
+
+    uint32_t size() const override { return length; }
+    uint32_t sectorSize() const override { return parent.sectorSize(); }
+
+    bool read(uint32_t address, uint32_t* data, size_t size) override {
+        return address + size <= length && parent.read(start + address, data, size);
+    }
+    bool write(uint32_t address, const uint32_t* data, size_t size) override {
+        return address + size <= length && parent.write(start + address, data, size);
+    }
+    bool eraseSector(uint32_t sector) override {
+        return sector < length / sectorSize() && parent.eraseSector(firstSector + sector);
+    }
+
+private:
+    FlashRegion& parent;
+    uint32_t start;
+    uint32_t length;
+    uint32_t firstSector;
+};
+
+// The flash the firmware keeps its data in, 0 if there is none.
+// ESP8266: the file system area of the flash layout (no file system is
+// used). ESP32: the spiffs partition. Native: the simulated flash.
+FlashRegion* flashDataRegion();
+
+// The first JOURNAL_SECTORS of it hold the state journal, the rest the
+// history. 0 if the data region is too small.
+FlashRegion* flashJournalRegion();
+FlashRegion* flashHistoryRegion();
@@ -0,0 +1,59 @@
+#include "hexParser.h"
+
+// 0..15, 0xFF for anything that isn't a hex digit
+static uint8_t nibble(uint8_t c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return 0xFF;
+}
+
+HexParser::Result HexParser::feed(uint8_t c) {
+    if (c == ':') {
+        // A command that didn't end is lost
+        Result result = state == WAIT_START ? MORE : fail();
+        state = COMMAND;
+        count = 0;
+        return result;
+    }
+    if (state == WAIT_START || c == '\r') {
+        return MORE;
+    }
+    if (c == '\n') {
+        // At least the checksum, and no half byte
+        if (state != HIGH_NIBBLE || !count || sum != 0x55) {
+            return fail();
+        }
+        state = WAIT_START;
+        return COMPLETE;
+    }
+
+    uint8_t value = nibble(c);
+    if (value == 0xFF) {
+        return fail();
+    }
+    switch (state) {
+        case COMMAND:
+            cmd = value;
+            sum = value;
+            state = HIGH_NIBBLE;
+            break;
+        case HIGH_NIBBLE:
+            if (count == MAX_BYTES) {
+                return fail();
+            }
+            high = value << 4;
+            state = LOW_NIBBLE;
+            break;
+        default:
+            bytes[count] = high | value;
+            sum += bytes[count++];
+            state = HIGH_NIBBLE;
+            break;
+    }
+    return MORE;
+}
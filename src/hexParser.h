@@ -0,0 +1,64 @@
+#pragma once
+
+// Incremental parser for commands of the VE.Direct HEX protocol.
+//
+// A command is ":<command nibble><bytes as hex digits><checksum>\n", the
+// bytes including the command sum up to 0x55. The parser takes one byte at
+// a time and never waits for more. '\r' is skipped, a ':' always starts a
+// new command, so the parser finds its way back after a broken one.
+
+#include <Arduino.h>
+
+#include "hexRegisters.h"
+
+class HexParser {
+public:
+    enum Result {
+        // Nothing complete yet
+        MORE,
+        // A command with a valid checksum is ready
+        COMPLETE,
+        // A command was dropped: bad digit, checksum or too long
+        FAILED
+    };
+
+    // Address, flags, value and checksum
+    static const uint8_t MAX_BYTES = 4 + HEX_MAX_VALUE;
+
+    HexParser() : state(WAIT_START), count(0), sum(0), high(0), cmd(0), numErrors(0) {}
+
+    Result feed(uint8_t c);
+    void reset() { state = WAIT_START; }
+    // Inside a command
+    bool busy() const { return state != WAIT_START; }
+
+    uint8_t command() const { return cmd; }
+    // The bytes after the command without the checksum, e.g. address, flags
+    // and value of a GET or SET
+    const uint8_t* data() const { return bytes; }
+    uint8_t dataSize() const { return count - 1; }
+    // Commands dropped so far
+    uint32_t errors() const { return numErrors; }
+
+private:
+    enum State {
+        WAIT_START,
+        COMMAND,
+        HIGH_NIBBLE,
+        LOW_NIBBLE
+    };
+
+    Result fail() {
+        state = WAIT_START;
+        ++numErrors;
+        return FAILED;
+    }
+
+    State state;
+    uint8_t bytes[MAX_BYTES];
+    uint8_t count;
+    uint8_t sum;
+    uint8_t high;
+    uint8_t cmd;
+    uint32_t numErrors;
+};
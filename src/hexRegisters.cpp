@@ -0,0 +1,347 @@
+#include "hexRegisters.h"
+
+#include "common.h"
+#include "statusHandling.h"
+
+static bool configChanged = false;
+
+// -- Product
+
+static uint8_t getSerial(uint8_t* value, uint8_t maxSize) {
+    char serialnr[16];
+#if ESP32
+    snprintf(serialnr, sizeof(serialnr), "%08X", (uint32_t)ESP.getEfuseMac());
+#else
+    snprintf(serialnr, sizeof(serialnr), "%08X", ESP.getChipId());
+#endif
+    uint8_t size = min((uint8_t)strlen(serialnr), maxSize);
+    memcpy(value, serialnr, size);
+    return size;
+}
+
+static uint8_t getModel(uint8_t* value, uint8_t maxSize) {
+    static const char model[] = "SmartShunt INA226";
+    uint8_t size = min((uint8_t)(sizeof(model) - 1), maxSize);
+    memcpy(value, model, size);
+    return size;
+}
+
+static uint8_t getName(uint8_t* value, uint8_t maxSize) {
+    uint8_t size = min((uint8_t)strlen(gCustomName), maxSize);
+    memcpy(value, gCustomName, size);
+    return size;
+}
+
+static bool setName(const uint8_t* value, uint8_t size) {
+    if (size >= sizeof(gCustomName)) {
+        return false;
+    }
+    memcpy(gCustomName, value, size);
+    gCustomName[size] = 0;
+    configChanged = true;
+    return true;
+}
+
+// Registers VictronConnect asks for that have no meaning here
+static int32_t getZero() { return 0; }
+
+// -- Monitor
+
+static int32_t getSoc() { return lroundf(gBattery.soc() * 10000); }
+
+static int32_t getTtg() {
+    // Minutes, 0xFFFF while the battery isn't discharging
+    float ttg = gBattery.tTg();
+    return ttg == INFINITY ? 0xFFFF : min(lroundf(ttg / 60), 0xFFFEL);
+}
+
+static int32_t getVoltage() { return lroundf(gBattery.voltage() * 100); }
+
+static int32_t getCurrentmA() { return lroundf(gBattery.current() * 1000); }
+
+static int32_t getPower() { return lroundf(gBattery.voltage() * gBattery.current()); }
+
+static int32_t getCurrent() { return lroundf(gBattery.current() * 10); }
+
+static int32_t getTemperature() {
+    // 0.01K, 0xFFFF without a temperature source
+    float celsius = gBattery.temperature();
+    return isnan(celsius) ? 0xFFFF : lroundf((celsius + 273.15f) * 100);
+}
+
+static int32_t getAlarmReason() {
+    // Like AR of the text protocol: 1 low voltage, 2 high voltage
+    return (gBattery.lowVoltageAlarm() ? 1 : 0) | (gBattery.highVoltageAlarm() ? 2 : 0);
+}
+
+static int32_t getSynchronised() { return gBattery.statistics().secsSinceLastFull >= 0; }
+
+static int32_t getConsumed() { return lroundf(gBattery.statistics().consumedAs / 360); }
+
+// -- History, the statistics hold mAh, mV and 0.01kWh
+
+static int32_t getDeepestDischarge() { return gBattery.statistics().deepestDischarge / 100; }
+static int32_t getLastDischarge() { return gBattery.statistics().lastDischarge / 100; }
+static int32_t getAverageDischarge() { return gBattery.statistics().averageDischarge / 100; }
+static int32_t getChargeCycles() { return gBattery.statistics().numChargeCycles; }
+static int32_t getFullDischarges() { return gBattery.statistics().numFullDischarge; }
+static int32_t getCumulativeAh() { return lroundf(gBattery.statistics().sumApHDrawn / 100); }
+static int32_t getMinVoltage() {
+    // No sample yet is INT32_MAX mV
+    uint32_t mV = gBattery.statistics().minBatVoltage;
+    return mV == INT32_MAX ? 0 : mV / 10;
+}
+static int32_t getMaxVoltage() { return gBattery.statistics().maxBatVoltage / 10; }
+static int32_t getSecsSinceFull() { return gBattery.statistics().secsSinceLastFull; }
+static int32_t getAutoSyncs() { return gBattery.statistics().numAutoSyncs; }
+static int32_t getLowVoltageAlarms() { return gBattery.statistics().numLowVoltageAlarms; }
+static int32_t getHighVoltageAlarms() { return gBattery.statistics().numHighVoltageAlarms; }
+static int32_t getDischargedEnergy() { return lroundf(gBattery.statistics().amountDischargedEnergy); }
+static int32_t getChargedEnergy() { return lroundf(gBattery.statistics().amountChargedEnergy); }
+
+// -- Battery settings, the same limits as the web configuration
+
+static int32_t getCapacity() { return gCapacityAh; }
+
+static bool setCapacity(int32_t value) {
+    if (value < 1 || value > UINT16_MAX) {
+        return false;
+    }
+    // The tail current register is relative to the capacity, keep it
+    uint32_t tailmA = ((uint32_t)gTailCurrentmA * value + gCapacityAh / 2) / gCapacityAh;
+    gTailCurrentmA = min(tailmA, (uint32_t)UINT16_MAX);
+    gCapacityAh = value;
+    configChanged = true;
+    return true;
+}
+
+static int32_t getChargedVoltage() { return gFullVoltagemV / 100; }
+
+static bool setChargedVoltage(int32_t value) {
+    // 0.1V
+    if (value < 1 || value > UINT16_MAX / 100) {
+        return false;
+    }
+    gFullVoltagemV = value * 100;
+    configChanged = true;
+    return true;
+}
+
+static int32_t getTailCurrent() { return (gTailCurrentmA + gCapacityAh / 2) / gCapacityAh; }
+
+static bool setTailCurrent(int32_t value) {
+    // 0.1% of the capacity
+    if (value < 1 || value * gCapacityAh > UINT16_MAX) {
+        return false;
+    }
+    gTailCurrentmA = value * gCapacityAh;
+    configChanged = true;
+    return true;
+}
+
+static int32_t getChargedTime() { return gFullDelayS / 60; }
+
+static bool setChargedTime(int32_t value) {
+    // Minutes
+    if (value < 1 || value > UINT16_MAX / 60) {
+        return false;
+    }
+    gFullDelayS = value * 60;
+    configChanged = true;
+    return true;
+}
+
+static int32_t getEfficiency() { return gChargeEfficiencyPercent; }
+
+static bool setEfficiency(int32_t value) {
+    if (value < 1 || value > 100) {
+        return false;
+    }
+    gChargeEfficiencyPercent = value;
+    configChanged = true;
+    return true;
+}
+
+static int32_t getPeukert() { return gPeukertExponent; }
+
+static bool setPeukert(int32_t value) {
+    if (value < 100 || value > 150) {
+        return false;
+    }
+    gPeukertExponent = value;
+    configChanged = true;
+    return true;
+}
+
+static int32_t getDischargeFloor() { return gMinPercent * 10; }
+
+static bool setDischargeFloor(int32_t value) {
+    // 0.1%, the configuration takes whole percents
+    if (value < 5 || value > 1004) {
+        return false;
+    }
+    gMinPercent = (value + 5) / 10;
+    configChanged = true;
+    return true;
+}
+
+// -- The table
+
+static constexpr HexRegister number(uint16_t id, HexType type, HexGetter get, HexSetter set = nullptr) {
+    return HexRegister{id, type, get, set, nullptr, nullptr};
+}
+
+static constexpr HexRegister text(uint16_t id, HexStringGetter get, HexStringSetter set = nullptr) {
+    return HexRegister{id, HEX_STRING, nullptr, nullptr, get, set};
+}
+
+// Sorted by id for the binary search
+static constexpr HexRegister registers[] = {
+    number(0x0104, HEX_UN8, getZero),               // Group id
+    text(0x010A, getSerial),                        // Serial number
+    text(0x010B, getModel),                         // Model name
+    text(0x010C, getName, setName),                 // Description
+    number(0x0300, HEX_SN32, getDeepestDischarge),  // 0.1Ah
+    number(0x0301, HEX_SN32, getLastDischarge),     // 0.1Ah
+    number(0x0302, HEX_SN32, getAverageDischarge),  // 0.1Ah
+    number(0x0303, HEX_UN32, getChargeCycles),
+    number(0x0304, HEX_UN32, getFullDischarges),
+    number(0x0305, HEX_SN32, getCumulativeAh),      // 0.1Ah
+    number(0x0306, HEX_SN32, getMinVoltage),        // 0.01V
+    number(0x0307, HEX_SN32, getMaxVoltage),        // 0.01V
+    number(0x0308, HEX_UN32, getSecsSinceFull),     // s
+    number(0x0309, HEX_UN32, getAutoSyncs),
+    number(0x030A, HEX_UN32, getLowVoltageAlarms),
+    number(0x030B, HEX_UN32, getHighVoltageAlarms),
+    number(0x0310, HEX_UN32, getDischargedEnergy),  // 0.01kWh
+    number(0x0311, HEX_UN32, getChargedEnergy),     // 0.01kWh
+    number(0x031E, HEX_UN16, getAlarmReason),
+    number(0x034F, HEX_UN8, getZero),
+    number(0x0FFE, HEX_UN16, getTtg),               // min
+    number(0x0FFF, HEX_UN16, getSoc),               // 0.01%
+    number(0x1000, HEX_UN16, getCapacity, setCapacity),          // Ah
+    number(0x1001, HEX_UN16, getChargedVoltage, setChargedVoltage),  // 0.1V
+    number(0x1002, HEX_UN16, getTailCurrent, setTailCurrent),    // 0.1%
+    number(0x1003, HEX_UN16, getChargedTime, setChargedTime),    // min
+    number(0x1004, HEX_UN16, getEfficiency, setEfficiency),      // %
+    number(0x1005, HEX_UN16, getPeukert, setPeukert),            // 0.01
+    // 0x1006 (current threshold) and 0x1007 (time to go averaging period)
+    // have no setting here, the current is never zeroed and the averaging
+    // period of the time to go is fixed
+    number(0x1008, HEX_UN16, getDischargeFloor, setDischargeFloor),  // 0.1%
+    number(0xED8C, HEX_SN32, getCurrentmA),         // mA
+    number(0xED8D, HEX_SN16, getVoltage),           // 0.01V
+    number(0xED8E, HEX_SN16, getPower),             // W
+    number(0xED8F, HEX_SN16, getCurrent),           // 0.1A
+    number(0xEDEC, HEX_UN16, getTemperature),       // 0.01K
+    number(0xEEB6, HEX_UN8, getSynchronised),
+    number(0xEEB8, HEX_SN16, getZero),              // DC monitor mode
+    number(0xEEFF, HEX_SN32, getConsumed),          // 0.1Ah
+};
+
+static const size_t NUM_REGISTERS = sizeof(registers) / sizeof(registers[0]);
+
+static constexpr bool sorted(const HexRegister* table, size_t count) {
+    return count < 2 || (table[0].id < table[1].id && sorted(table + 1, count - 1));
+}
+static_assert(sorted(registers, sizeof(registers) / sizeof(registers[0])), "HEX registers must be sorted by id");
+
+static uint8_t typeSize(HexType type) {
+    switch (type) {
+        case HEX_UN8:
+            return 1;
+        case HEX_UN16:
+        case HEX_SN16:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+const HexRegister* hexRegisterFind(uint16_t id) {
+    size_t low = 0;
+    size_t high = NUM_REGISTERS;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (registers[mid].id < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < NUM_REGISTERS && registers[low].id == id ? &registers[low] : 0;
+}
+
+uint8_t hexRegisterGet(uint16_t id, uint8_t* value, uint8_t& size) {
+    const HexRegister* reg = hexRegisterFind(id);
+    size = 0;
+    if (!reg) {
+        return FLAG_UNKNOWN_ID;
+    }
+    if (reg->type == HEX_STRING) {
+        size = reg->getString(value, HEX_MAX_VALUE);
+        return FLAG_OK;
+    }
+
+    int32_t number = reg->get();
+    // Out of range values saturate
+    switch (reg->type) {
+        case HEX_UN8:
+            number = constrain(number, 0, UINT8_MAX);
+            break;
+        case HEX_UN16:
+            number = constrain(number, 0, UINT16_MAX);
+            break;
+        case HEX_SN16:
+            number = constrain(number, INT16_MIN, INT16_MAX);
+            break;
+        default:
+            break;
+    }
+    size = typeSize(reg->type);
+    for (uint8_t i = 0; i < size; ++i) {
+        value[i] = (uint8_t)((uint32_t)number >> (8 * i));
+    }
+    return FLAG_OK;
+}
+
+uint8_t hexRegisterSet(uint16_t id, const uint8_t* value, uint8_t size) {
+    const HexRegister* reg = hexRegisterFind(id);
+    if (!reg) {
+        return FLAG_UNKNOWN_ID;
+    }
+    if (reg->type == HEX_STRING) {
+        return reg->setString && reg->setString(value, size) ? FLAG_OK : FLAG_PARAMETER_ERROR;
+    }
+    if (!reg->set || size != typeSize(reg->type)) {
+        return FLAG_PARAMETER_ERROR;
+    }
+
+    uint32_t bits = 0;
+    for (uint8_t i = 0; i < size; ++i) {
+        bits |= (uint32_t)value[i] << (8 * i);
+    }
+    int32_t number;
+    switch (reg->type) {
+        case HEX_SN16:
+            number = (int16_t)bits;
+            break;
+        case HEX_UN32:
+            // Nothing writable needs more than 31 bits
+            if (bits > INT32_MAX) {
+                return FLAG_PARAMETER_ERROR;
+            }
+            number = bits;
+            break;
+        default:
+            number = (int32_t)bits;
+            break;
+    }
+    return reg->set(number) ? FLAG_OK : FLAG_PARAMETER_ERROR;
+}
+
+bool hexConfigChanged() {
+    bool changed = configChanged;
+    configChanged = false;
+    return changed;
+}
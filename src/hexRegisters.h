@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+
+// The registers of a SmartShunt for GET and SET of the VE.Direct HEX
+// protocol. Values are little endian in the unit of the register.
+
+enum HexFlags {
+    FLAG_OK = 0x0,
+    FLAG_UNKNOWN_ID = 0x1,
+    FLAG_NOT_SUPPORTED = 0x2,
+    FLAG_PARAMETER_ERROR = 0x4
+};
+
+enum HexType : uint8_t {
+    HEX_UN8,
+    HEX_UN16,
+    HEX_SN16,
+    HEX_UN32,
+    HEX_SN32,
+    HEX_STRING
+};
+
+// Number values are scaled to the unit of the register by the getter,
+// un32 values are passed as their bit pattern
+typedef int32_t (*HexGetter)();
+typedef bool (*HexSetter)(int32_t value);
+typedef uint8_t (*HexStringGetter)(uint8_t* value, uint8_t maxSize);
+typedef bool (*HexStringSetter)(const uint8_t* value, uint8_t size);
+
+struct HexRegister {
+    uint16_t id;
+    HexType type;
+    HexGetter get;
+    HexSetter set;
+    HexStringGetter getString;
+    HexStringSetter setString;
+};
+
+// Longest value a register can have
+static const uint8_t HEX_MAX_VALUE = 64;
+
+// 0 if the register isn't known
+const HexRegister* hexRegisterFind(uint16_t id);
+// Writes the value of a register, returns the flags of the answer
+uint8_t hexRegisterGet(uint16_t id, uint8_t* value, uint8_t& size);
+uint8_t hexRegisterSet(uint16_t id, const uint8_t* value, uint8_t size);
+// True once after a SET changed the configuration
+bool hexConfigChanged();
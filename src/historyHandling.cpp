@@ -0,0 +1,118 @@
+#include "common.h"
+#include "historyHandling.h"
+#include "statusHandling.h"
+#include "timeHandling.h"
+
+static const uint32_t MINUTE_MS = 60000;
+// What the load profile learns from at boot
+static const uint32_t PROFILE_SEED_MINUTES = 7 * 1440;
+// Minutes before this were counted without a clock
+static const uint32_t FIRST_CLOCK_MINUTE = 1600000000 / 60;
+
+static HistoryStore* store = 0;
+static RollupPyramid rollup;
+
+// The running minute. Charge in nAs, so the integer sums stay exact.
+static struct {
+    int64_t chargeIn;
+    int64_t chargeOut;
+    // Carried over to the next minute, only whole mAh are stored
+    int64_t restIn;
+    int64_t restOut;
+    float duration;
+    float voltageSum;
+    float currentMin;
+    float currentMax;
+    uint32_t numSamples;
+} minute;
+
+void historyInit() {
+    FlashRegion* region = flashHistoryRegion();
+    if (!region) {
+        return;
+    }
+    store = new HistoryStore(*region);
+    store->begin();
+
+    // The load profile of the first battery starts with the last week
+    if (!store->empty() && store->lastMinute() >= FIRST_CLOCK_MINUTE + PROFILE_SEED_MINUTES) {
+        HistoryStore::Reader reader(*store, store->lastMinute() - PROFILE_SEED_MINUTES, store->lastMinute());
+        HistoryPoint point;
+        while (reader.next(point)) {
+            gBattery.loadProfile().addMinute(point.minute, point.current * -0.01f);
+        }
+    }
+}
+
+void historyAddSample(float current, float voltage, float duration) {
+    rollup.add(current, voltage, duration);
+
+    int64_t charge = (int64_t)(current * duration * 1e9f);
+    if (charge >= 0) {
+        minute.chargeIn += charge;
+    } else {
+        minute.chargeOut -= charge;
+    }
+    if (!minute.numSamples || current < minute.currentMin) {
+        minute.currentMin = current;
+    }
+    if (!minute.numSamples || current > minute.currentMax) {
+        minute.currentMax = current;
+    }
+    minute.duration += duration;
+    minute.voltageSum += voltage * duration;
+    ++minute.numSamples;
+}
+
+// Whole mAh of charge, the rest stays for the next minute
+static uint16_t takemAh(int64_t charge, int64_t& rest) {
+    static const int64_t NAS_PER_MAH = 3600000000LL;
+    charge += rest;
+    int64_t mAh = charge / NAS_PER_MAH;
+    rest = charge - mAh * NAS_PER_MAH;
+    return min(mAh, (int64_t)UINT16_MAX);
+}
+
+void historyLoop(uint64_t nowMs) {
+    static uint64_t lastMinute = 0;
+    if (!store || nowMs - lastMinute < MINUTE_MS) {
+        return;
+    }
+    // Stays on the minute grid, unless the loop was stuck for longer
+    lastMinute = nowMs - lastMinute < 2 * MINUTE_MS ? lastMinute + MINUTE_MS : nowMs;
+    if (!minute.numSamples || minute.duration <= 0) {
+        // Nothing measured, the minute stays a gap
+        return;
+    }
+
+    HistoryPoint point;
+    // Without a clock the minutes are counted on from the stored ones. The
+    // reader needs them ascending, so they never go back.
+    point.minute = epochSeconds() / 60;
+    if (!store->empty() && point.minute <= store->lastMinute()) {
+        point.minute = store->lastMinute() + 1;
+    }
+    float average = (minute.chargeIn - minute.chargeOut) * 1e-9f / minute.duration;
+    point.current = lroundf(average * 100);
+    point.currentMin = min((int32_t)lroundf(minute.currentMin * 100), point.current);
+    point.currentMax = max((int32_t)lroundf(minute.currentMax * 100), point.current);
+    point.voltage = constrain(lroundf(minute.voltageSum / minute.duration * 100), 0L, (long)UINT16_MAX);
+    point.soc = constrain(lroundf(gBattery.soc() * 1000), 0L, 1000L);
+    point.mAhIn = takemAh(minute.chargeIn, minute.restIn);
+    point.mAhOut = takemAh(minute.chargeOut, minute.restOut);
+    store->append(point);
+
+    int64_t restIn = minute.restIn;
+    int64_t restOut = minute.restOut;
+    memset(&minute, 0, sizeof(minute));
+    minute.restIn = restIn;
+    minute.restOut = restOut;
+}
+
+HistoryStore* historyStore() {
+    return store;
+}
+
+const RollupPyramid& historyRollup() {
+    return rollup;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "historyStore.h"
+#include "rollupPyramid.h"
+
+// Finds where the history in flash ends and seeds the load profile of the
+// first battery from it
+void historyInit();
+// Adds a sample of the first battery to the running minute and the rollups
+void historyAddSample(float current, float voltage, float duration);
+// Stores the running minute once it is complete
+void historyLoop(uint64_t nowMs);
+
+// The store, 0 if the flash has no room for it
+HistoryStore* historyStore();
+
+// Rollups of the first battery in RAM, they start over on every boot
+const RollupPyramid& historyRollup();
@@ -0,0 +1,307 @@
+#include "historyStore.h"
+
+// "SHHS"
+static const uint32_t SECTOR_MAGIC = 0x53484853;
+
+// Bits of the record byte, a set bit means the field follows
+enum {
+    FIELD_CURRENT = 0x01, // change of the average, zigzag
+    FIELD_MIN = 0x02,     // average - minimum
+    FIELD_MAX = 0x04,     // maximum - average
+    FIELD_VOLTAGE = 0x08, // change, zigzag
+    FIELD_SOC = 0x10,     // change, zigzag
+    FIELD_IN = 0x20,
+    FIELD_OUT = 0x40,
+    // Followed by the minutes the next point is off, zigzag
+    RECORD_TIME_JUMP = 0x80,
+    RECORD_END = 0xFF
+};
+
+static uint32_t zigzag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+
+static int32_t unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+static uint8_t putVarint(uint8_t* out, uint32_t value) {
+    uint8_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = value | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+// Encodes point against previous, returns the number of bytes
+static size_t encode(const HistoryPoint& point, const HistoryPoint& previous, uint8_t* out) {
+    size_t length = 0;
+    if (point.minute != previous.minute + 1) {
+        out[length++] = RECORD_TIME_JUMP;
+        length += putVarint(out + length, zigzag(point.minute - previous.minute - 1));
+    }
+
+    uint32_t values[7] = {zigzag(point.current - previous.current),
+                          (uint32_t)max(point.current - point.currentMin, (int32_t)0),
+                          (uint32_t)max(point.currentMax - point.current, (int32_t)0),
+                          zigzag(point.voltage - previous.voltage),
+                          zigzag(point.soc - previous.soc),
+                          point.mAhIn,
+                          point.mAhOut};
+    size_t head = length++;
+    uint8_t fields = 0;
+    for (uint8_t i = 0; i < 7; ++i) {
+        if (values[i]) {
+            fields |= 1 << i;
+            length += putVarint(out + length, values[i]);
+        }
+    }
+    out[head] = fields;
+    return length;
+}
+
+void HistoryStore::Decoder::start(FlashRegion& region, uint32_t sector, const SectorHeader& header) {
+    flash = &region;
+    base = sector * region.sectorSize();
+    pos = sizeof(SectorHeader);
+    cacheStart = UINT32_MAX;
+    state.minute = header.minute;
+    state.current = state.currentMin = state.currentMax = header.current;
+    state.voltage = header.voltage;
+    state.soc = header.soc;
+    state.mAhIn = state.mAhOut = 0;
+}
+
+bool HistoryStore::Decoder::readByte(uint8_t& value) {
+    if (pos >= flash->sectorSize()) {
+        return false;
+    }
+    if (pos < cacheStart || pos >= cacheStart + sizeof(cache)) {
+        cacheStart = pos & ~(sizeof(cache) - 1);
+        if (!flash->read(base + cacheStart, cache, sizeof(cache))) {
+            cacheStart = UINT32_MAX;
+            return false;
+        }
+    }
+    value = ((const uint8_t*)cache)[pos - cacheStart];
+    ++pos;
+    return true;
+}
+
+bool HistoryStore::Decoder::readVarint(uint32_t& value) {
+    uint8_t byte;
+    value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (!readByte(byte)) {
+            return false;
+        }
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+HistoryStore::Decoder::Result HistoryStore::Decoder::next(HistoryPoint& point) {
+    uint8_t head;
+    uint32_t value;
+    uint32_t minute = state.minute + 1;
+
+    if (!readByte(head) || head == RECORD_END) {
+        return END;
+    }
+    if (head == RECORD_TIME_JUMP) {
+        if (!readVarint(value) || !readByte(head)) {
+            return BROKEN;
+        }
+        minute += unzigzag(value);
+    }
+    if (head & RECORD_TIME_JUMP) {
+        return BROKEN;
+    }
+
+    uint32_t values[7] = {0};
+    for (uint8_t i = 0; i < 7; ++i) {
+        if ((head & (1 << i)) && !readVarint(values[i])) {
+            return BROKEN;
+        }
+    }
+    state.minute = minute;
+    state.current += unzigzag(values[0]);
+    state.currentMin = state.current - values[1];
+    state.currentMax = state.current + values[2];
+    state.voltage += unzigzag(values[3]);
+    state.soc += unzigzag(values[4]);
+    state.mAhIn = values[5];
+    state.mAhOut = values[6];
+    point = state;
+    return POINT;
+}
+
+HistoryStore::HistoryStore(FlashRegion& flash)
+    : flash(flash), numSectors(flash.size() / flash.sectorSize()), sector(0), offset(0), seq(0),
+      tailWord(0xFFFFFFFF), haveLast(false), numBytes(0), numPoints(0) {
+    memset(&last, 0, sizeof(last));
+}
+
+bool HistoryStore::readHeader(uint32_t s, SectorHeader& header) {
+    return flash.read(s * flash.sectorSize(), (uint32_t*)&header, sizeof(header)) && header.magic == SECTOR_MAGIC;
+}
+
+void HistoryStore::begin() {
+    SectorHeader header;
+    bool found = false;
+
+    for (uint32_t s = 0; s < numSectors; ++s) {
+        if (readHeader(s, header) && (!found || (int32_t)(header.seq - seq) > 0)) {
+            found = true;
+            seq = header.seq;
+            sector = s;
+        }
+    }
+    haveLast = false;
+    if (!found || numSectors < 2) {
+        // The first append starts at sector 0
+        sector = numSectors - 1;
+        offset = flash.sectorSize();
+        seq = 0;
+        return;
+    }
+
+    Decoder decoder;
+    HistoryPoint point;
+    HistoryStore::Decoder::Result result;
+    uint32_t end = sizeof(SectorHeader);
+    readHeader(sector, header);
+    decoder.start(flash, sector, header);
+    while ((result = decoder.next(point)) == Decoder::POINT) {
+        end = decoder.pos;
+    }
+    last = decoder.state;
+    haveLast = true;
+    // Nothing can be appended behind a broken record
+    offset = result == Decoder::END ? end : flash.sectorSize();
+    tailWord = 0xFFFFFFFF;
+    if (offset % 4 && offset < flash.sectorSize()) {
+        flash.read(sector * flash.sectorSize() + (offset & ~3), &tailWord, 4);
+    }
+}
+
+// As in the state journal the magic is written last, a sector with a torn
+// header doesn't count.
+bool HistoryStore::startSector() {
+    sector = (sector + 1) % numSectors;
+    // Should anything fail, the next append starts over with a new sector
+    offset = flash.sectorSize();
+    if (!flash.eraseSector(sector)) {
+        return false;
+    }
+    SectorHeader header = {SECTOR_MAGIC, seq + 1, last.minute, last.current, last.voltage, last.soc};
+    const uint32_t* words = (const uint32_t*)&header;
+    uint32_t base = sector * flash.sectorSize();
+    if (!flash.write(base + 4, words + 1, sizeof(header) - 4) || !flash.write(base, words, 4)) {
+        return false;
+    }
+    ++seq;
+    offset = sizeof(header);
+    tailWord = 0xFFFFFFFF;
+    return true;
+}
+
+// NOR flash is written in words. The word the previous record ended in is
+// written again, its bytes keep their value and the erased ones get the
+// start of this record.
+bool HistoryStore::writeBytes(const uint8_t* data, size_t length) {
+    uint32_t words[16];
+    uint32_t first = offset & ~3;
+    uint32_t count = (offset + length - first + 3) / 4;
+    if (count > sizeof(words) / 4) {
+        return false;
+    }
+    memset(words, 0xFF, sizeof(words));
+    words[0] = tailWord;
+    memcpy((uint8_t*)words + (offset - first), data, length);
+    if (!flash.write(sector * flash.sectorSize() + first, words, count * 4)) {
+        offset = flash.sectorSize();
+        return false;
+    }
+    offset += length;
+    tailWord = offset % 4 ? words[count - 1] : 0xFFFFFFFF;
+    return true;
+}
+
+bool HistoryStore::append(const HistoryPoint& point) {
+    uint8_t record[48];
+
+    if (numSectors < 2) {
+        return false;
+    }
+    if (!haveLast) {
+        last = point;
+        --last.minute;
+        haveLast = true;
+    }
+    size_t length = encode(point, last, record);
+    if (offset + length > flash.sectorSize() && !startSector()) {
+        return false;
+    }
+    if (!writeBytes(record, length)) {
+        return false;
+    }
+    last = point;
+    numBytes += length;
+    ++numPoints;
+    return true;
+}
+
+HistoryStore::Reader::Reader(HistoryStore& store, uint32_t fromMinute, uint32_t toMinute)
+    : store(store), fromMinute(fromMinute), toMinute(toMinute), sector(0), seq(0), open(false) {
+    SectorHeader header;
+    bool found = false;
+
+    // The oldest sector
+    for (uint32_t s = 0; s < store.numSectors; ++s) {
+        if (store.readHeader(s, header) && (!found || (int32_t)(header.seq - seq) < 0)) {
+            found = true;
+            seq = header.seq;
+            sector = s;
+        }
+    }
+    if (!found) {
+        return;
+    }
+    // Skip the sectors that end before the range
+    while (true) {
+        uint32_t next = (sector + 1) % store.numSectors;
+        if (!store.readHeader(next, header) || header.seq != seq + 1 || header.minute >= fromMinute) {
+            break;
+        }
+        sector = next;
+        ++seq;
+    }
+    store.readHeader(sector, header);
+    decoder.start(store.flash, sector, header);
+    open = true;
+}
+
+bool HistoryStore::Reader::next(HistoryPoint& point) {
+    SectorHeader header;
+    while (open) {
+        if (decoder.next(point) == Decoder::POINT) {
+            if (point.minute > toMinute) {
+                open = false;
+            } else if (point.minute >= fromMinute) {
+                return true;
+            }
+            continue;
+        }
+        uint32_t next = (sector + 1) % store.numSectors;
+        if (store.readHeader(next, header) && header.seq == seq + 1) {
+            sector = next;
+            ++seq;
+            decoder.start(store.flash, sector, header);
+        } else {
+            open = false;
+        }
+    }
+    return false;
+}
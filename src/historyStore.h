@@ -0,0 +1,111 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "flashRegion.h"
+
+// One minute of battery history
+struct HistoryPoint {
+    // Minutes since 1970, or counted on from the last stored minute while
+    // the clock isn't set
+    uint32_t minute;
+    // Average, minimum and maximum current in 10mA
+    int32_t current;
+    int32_t currentMin;
+    int32_t currentMax;
+    // Average voltage in 10mV
+    uint16_t voltage;
+    // SOC at the end of the minute in 0.1%
+    uint16_t soc;
+    // Charge that went into and out of the battery in mAh
+    uint16_t mAhIn;
+    uint16_t mAhOut;
+};
+
+// Per minute history in a ring of flash sectors.
+//
+// Every sector starts with a header holding the values of the point before
+// its first one. A point is stored as a byte with a bit per field and the
+// fields that aren't 0 as varints: the change of average current, voltage
+// and SOC against the previous point (zigzag), the distance of minimum and
+// maximum from the average and the charge in and out. A point that follows
+// its predecessor by more than a minute is preceded by a time jump. A
+// steady minute takes a few bytes. When the ring is full the oldest sector
+// is erased.
+class HistoryStore {
+public:
+    HistoryStore(FlashRegion& flash);
+
+    // Finds the newest sector and where to continue writing
+    void begin();
+    bool append(const HistoryPoint& point);
+
+    bool empty() const { return !haveLast; }
+    uint32_t lastMinute() const { return last.minute; }
+    uint32_t bytesWritten() const { return numBytes; }
+    uint32_t pointsWritten() const { return numPoints; }
+
+private:
+    struct SectorHeader {
+        uint32_t magic;
+        uint32_t seq;
+        // The point before the first one of the sector
+        uint32_t minute;
+        int32_t current;
+        uint16_t voltage;
+        uint16_t soc;
+    };
+
+    // Reads the points of one sector through a small cache
+    struct Decoder {
+        enum Result { POINT, END, BROKEN };
+
+        void start(FlashRegion& region, uint32_t sector, const SectorHeader& header);
+        Result next(HistoryPoint& point);
+        bool readByte(uint8_t& value);
+        bool readVarint(uint32_t& value);
+
+        FlashRegion* flash;
+        uint32_t base;
+        uint32_t pos;
+        uint32_t cacheStart;
+        uint32_t cache[8];
+        HistoryPoint state;
+    };
+
+public:
+    // Streams the points of a time range, oldest first. Only the sector
+    // being read is touched, a few words at a time.
+    class Reader {
+    public:
+        Reader(HistoryStore& store, uint32_t fromMinute, uint32_t toMinute);
+        bool next(HistoryPoint& point);
+
+    private:
+        HistoryStore& store;
+        uint32_t fromMinute;
+        uint32_t toMinute;
+        uint32_t sector;
+        uint32_t seq;
+        bool open;
+        Decoder decoder;
+    };
+
+private:
+    bool readHeader(uint32_t sector, SectorHeader& header);
+    bool startSector();
+    bool writeBytes(const uint8_t* data, size_t length);
+
+    FlashRegion& flash;
+    uint32_t numSectors;
+    uint32_t sector;
+    uint32_t offset;
+    uint32_t seq;
+    // The word the last record ends in, it gets written again with the
+    // bytes of the next one
+    uint32_t tailWord;
+    HistoryPoint last;
+    bool haveLast;
+    uint32_t numBytes;
+    uint32_t numPoints;
+};
@@ -0,0 +1,73 @@
+#include "loadProfile.h"
+
+static const uint8_t MINUTES_PER_BUCKET = 15;
+// Fewer minutes don't make a quarter hour
+static const uint8_t MIN_MINUTES = 8;
+// Weight of a new day once there are enough of them, about a week
+static const uint8_t MAX_DAYS_WEIGHT = 8;
+// How far the prediction looks ahead
+static const uint8_t MAX_DAYS = 7;
+
+LoadProfile::LoadProfile() : numLearned(0), openQuarter(0), openSum(0), openMinutes(0) {
+    memset(current, 0, sizeof(current));
+    memset(days, 0, sizeof(days));
+    memset(remainder, 0, sizeof(remainder));
+}
+
+void LoadProfile::closeBucket() {
+    if (openMinutes >= MIN_MINUTES) {
+        uint8_t bucket = openQuarter % BUCKETS;
+        int32_t average = openSum / openMinutes;
+        if (!days[bucket]) {
+            ++numLearned;
+        }
+        if (days[bucket] < MAX_DAYS_WEIGHT) {
+            ++days[bucket];
+        }
+        // The part of the step the division cuts off is carried to the next
+        // day, else the mean stops short by up to days * 10mA
+        int32_t delta = average - current[bucket] + remainder[bucket];
+        int32_t step = delta / days[bucket];
+        current[bucket] += step;
+        remainder[bucket] = delta - step * days[bucket];
+    }
+    openSum = 0;
+    openMinutes = 0;
+}
+
+void LoadProfile::addMinute(uint32_t minute, float value) {
+    uint32_t quarter = minute / MINUTES_PER_BUCKET;
+    if (quarter != openQuarter) {
+        closeBucket();
+        openQuarter = quarter;
+    }
+    openSum += constrain(lroundf(value * 100), (long)INT16_MIN, (long)INT16_MAX);
+    ++openMinutes;
+}
+
+float LoadProfile::timeToGo(uint32_t minute, float usableAs, float maxAs, float efficiency) const {
+    uint8_t bucket = (minute / MINUTES_PER_BUCKET) % BUCKETS;
+    // The rest of the running quarter hour first
+    float seconds = (MINUTES_PER_BUCKET - minute % MINUTES_PER_BUCKET) * 60.0f;
+    float level = usableAs;
+    float time = 0;
+
+    if (usableAs <= 0) {
+        return 0;
+    }
+    for (uint16_t step = 0; step <= MAX_DAYS * BUCKETS; ++step) {
+        float amps = current[bucket] * 0.01f;
+        if (amps > 0) {
+            if (amps * seconds >= level) {
+                return time + level / amps;
+            }
+            level -= amps * seconds;
+        } else {
+            level = min(level - amps * seconds * efficiency, maxAs);
+        }
+        time += seconds;
+        seconds = MINUTES_PER_BUCKET * 60.0f;
+        bucket = (bucket + 1) % BUCKETS;
+    }
+    return INFINITY;
+}
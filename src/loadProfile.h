@@ -0,0 +1,50 @@
+#pragma once
+
+// Average battery current per quarter hour of the day, learned over the
+// days, and the time to go it predicts.
+//
+// Every minute adds its average current to the running quarter hour. A
+// quarter hour with at least half of its minutes goes into its bucket as a
+// mean over the days that turns into an exponential one after a week, so
+// the profile follows the season. That is 96 buckets of 4 bytes and O(1)
+// per minute.
+//
+// The prediction walks the buckets from now on, drawing the expected
+// charge (and adding what is expected to come in) until the usable charge
+// is gone. It is bounded to a few days and runs once per minute.
+
+#include <Arduino.h>
+
+class LoadProfile {
+public:
+    static const uint8_t BUCKETS = 96;
+    static const uint16_t MINUTES_PER_DAY = 1440;
+
+    LoadProfile();
+
+    // minute: minutes since 1970 (UTC), current: average of that minute in
+    // A, positive when discharging
+    void addMinute(uint32_t minute, float current);
+    // Every bucket has been seen at least once
+    bool ready() const { return numLearned == BUCKETS; }
+    uint8_t learnedBuckets() const { return numLearned; }
+    // In A, positive when discharging
+    float bucketCurrent(uint8_t bucket) const { return current[bucket] * 0.01f; }
+
+    // Seconds until usableAs are drawn starting at minute, INFINITY if that
+    // takes longer than MAX_DAYS. Charging adds with efficiency, up to
+    // maxAs.
+    float timeToGo(uint32_t minute, float usableAs, float maxAs, float efficiency) const;
+
+private:
+    void closeBucket();
+
+    int16_t current[BUCKETS]; // 10mA
+    uint8_t days[BUCKETS];
+    int8_t remainder[BUCKETS]; // 10mA / days, what the mean is still off
+    uint8_t numLearned;
+    // The running quarter hour, counted since 1970
+    uint32_t openQuarter;
+    int32_t openSum;
+    uint8_t openMinutes;
+};
@@ -15,6 +15,7 @@
 #include "webHandling.h"
 #include "modbusHandling.h"
 #include "victronHandling.h"
+#include "statusHandling.h"
 
 
 void setup() {
@@ -37,6 +38,12 @@ void setup() {
     sensorInit();
     modbusInit();
     victronInit();
+#ifdef BENCH_CONSUMPTION
+    benchmarkConsumption();
+#endif
+#ifdef BENCH_VEDIRECT
+    benchmarkVictron();
+#endif
 }
 
 void loop() {
@@ -34,6 +34,9 @@ enum INPUT_REGISTERS {
   REG_TIMETOGOHIGH,
   REG_SOC,
   REG_FULL,
+  REG_LEARNED_CAPACITY,
+  REG_LEARNED_EFFICIENCY,
+  REG_TEMPERATURE,
   REG_NUM_INPUT_REGISTERS
 };
 
@@ -56,6 +59,10 @@ uint16_t inputGetter(uint16_t address)
 {
   INPUT_REGISTERS regNum = (INPUT_REGISTERS)(address);
 
+  // All of them belong to the first battery
+  if (!sensorPresent(0)) {
+    return UINT16_MAX;
+  }
   switch (regNum) {
     case REG_Voltage:
       return (uint16_t)(gBattery.voltage()*100.0f);
@@ -76,10 +83,10 @@ uint16_t inputGetter(uint16_t address)
         return (uint16_t)0;
         break;
     case REG_HIGH_VOLTAGE_ALARM_STATUS:
-      return (uint16_t)0; // Not yet implemented
+      return gBattery.highVoltageAlarm();
       break;
     case REG_LOW_VOLTAGE_ALARM_STATUS:
-      return (uint16_t)0; // Not yet implemented
+      return gBattery.lowVoltageAlarm();
       break;    
     case REG_TIMETOGOLOW:
       return (uint16_t) (gBattery.tTg());
@@ -93,6 +100,21 @@ uint16_t inputGetter(uint16_t address)
     case REG_FULL:
       return gBattery.isFull();
       break;
+    case REG_LEARNED_CAPACITY:
+      // 0.1Ah, 0 while nothing was learned
+      return (uint16_t)min(gBattery.capacityLearner().capacityAs() / 360.0f, 65535.0f);
+      break;
+    case REG_LEARNED_EFFICIENCY:
+      // 0.1%
+      return (uint16_t)(gBattery.capacityLearner().efficiency() * 1000.0f);
+      break;
+    case REG_TEMPERATURE:
+      // 0.1 degrees, signed, 0x8000 without a temperature source
+      if (isnan(gBattery.temperature())) {
+        return 0x8000;
+      }
+      return (uint16_t)(int16_t)lroundf(gBattery.temperature() * 10.0f);
+      break;
       
     default:
       return UINT16_MAX;
@@ -106,10 +128,11 @@ uint16_t holdingGetter(uint16_t address)
 
   switch (regNum) {
     case REG_HIGH_VOLTAGE_ALARM_THRESHOLD:
-      return (uint16_t)(UINT16_MAX); // Not yet implemented
+      // 0.01V like REG_Voltage
+      return gHighVoltageAlarmmV ? gHighVoltageAlarmmV / 10 : UINT16_MAX;
       break;
     case REG_LOW_VOLTAGE_ALARM_THRESHOLD:
-      return (uint16_t)(0); // Not yet implemented
+      return gLowVoltageAlarmmV / 10;
       break;
     case REG_MODBUS_ADDRESS:
       return (uint16_t)(gModbusId);
@@ -141,10 +164,19 @@ uint16_t setter(TRegister *reg, uint16_t val)
 
   switch (regNum) {
     case REG_HIGH_VOLTAGE_ALARM_THRESHOLD:
-      return (uint16_t)(UINT16_MAX); // Not yet implemented
+      // UINT16_MAX and everything above 655.35V turns it off
+      gHighVoltageAlarmmV = val < 6554 ? val * 10 : 0;
+      wifiSetAlarmVals();
+      gParamsChanged = true;
+      saveConfig = true;
+      return holdingGetter(REG_HIGH_VOLTAGE_ALARM_THRESHOLD);
       break;
     case REG_LOW_VOLTAGE_ALARM_THRESHOLD:
-      return (uint16_t)(0); // Not yet implemented
+      gLowVoltageAlarmmV = val < 6554 ? val * 10 : 0;
+      wifiSetAlarmVals();
+      gParamsChanged = true;
+      saveConfig = true;
+      return holdingGetter(REG_LOW_VOLTAGE_ALARM_THRESHOLD);
       break;
     case REG_MODBUS_ADDRESS:
         if(val != gModbusId) {
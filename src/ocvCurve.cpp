@@ -0,0 +1,68 @@
+#include "ocvCurve.h"
+
+static const uint8_t OCV_POINTS = 11;
+
+// mV per cell at 0%, 10% ... 100%
+#if BATTERY_CHEMISTRY == CHEMISTRY_LFP
+static const uint16_t OCV_CELL_MV[OCV_POINTS] = {2900, 3200, 3250, 3270, 3285, 3300, 3310, 3320, 3330, 3345, 3400};
+#elif BATTERY_CHEMISTRY == CHEMISTRY_LEAD_ACID
+static const uint16_t OCV_CELL_MV[OCV_POINTS] = {1750, 1885, 1930, 1958, 1983, 2010, 2033, 2053, 2070, 2083, 2117};
+#elif BATTERY_CHEMISTRY == CHEMISTRY_NMC
+static const uint16_t OCV_CELL_MV[OCV_POINTS] = {3000, 3450, 3550, 3610, 3660, 3710, 3770, 3850, 3940, 4050, 4180};
+#else
+#error "Unknown BATTERY_CHEMISTRY"
+#endif
+
+static const float VOLTS_PER_CELL_MV = BATTERY_CELLS / 1000.0f;
+
+// Segment of soc and the position in it
+static uint8_t segment(float soc, float& fraction) {
+    float position = constrain(soc, 0.0f, 1.0f) * (OCV_POINTS - 1);
+    uint8_t index = min((uint8_t)position, (uint8_t)(OCV_POINTS - 2));
+    fraction = position - index;
+    return index;
+}
+
+float ocvVoltage(float soc) {
+    float fraction;
+    uint8_t i = segment(soc, fraction);
+    return (OCV_CELL_MV[i] + (OCV_CELL_MV[i + 1] - OCV_CELL_MV[i]) * fraction) * VOLTS_PER_CELL_MV;
+}
+
+float ocvSlope(float soc) {
+    float fraction;
+    uint8_t i = segment(soc, fraction);
+    return (OCV_CELL_MV[i + 1] - OCV_CELL_MV[i]) * VOLTS_PER_CELL_MV * (OCV_POINTS - 1);
+}
+
+// SOC in 1/65535 over equal steps of the cell voltage from the first to
+// the last point of the curve. 64 steps keep the error from a bend of the
+// curve between two steps below 0.5% SOC.
+static const uint8_t INVERSE_STEPS = 64;
+static const float INVERSE_STEP_MV = (float)(OCV_CELL_MV[OCV_POINTS - 1] - OCV_CELL_MV[0]) / INVERSE_STEPS;
+static uint16_t inverseSoc[INVERSE_STEPS + 1];
+
+static void buildInverse() {
+    uint8_t i = 0;
+    for (uint8_t step = 0; step <= INVERSE_STEPS; ++step) {
+        float mV = OCV_CELL_MV[0] + step * INVERSE_STEP_MV;
+        while (i < OCV_POINTS - 2 && mV > OCV_CELL_MV[i + 1]) {
+            ++i;
+        }
+        float fraction = constrain((mV - OCV_CELL_MV[i]) / (OCV_CELL_MV[i + 1] - OCV_CELL_MV[i]), 0.0f, 1.0f);
+        inverseSoc[step] = lroundf((i + fraction) / (OCV_POINTS - 1) * UINT16_MAX);
+    }
+}
+
+float ocvSoc(float voltage) {
+    static bool built = false;
+    if (!built) {
+        buildInverse();
+        built = true;
+    }
+    float position = constrain((voltage / VOLTS_PER_CELL_MV - OCV_CELL_MV[0]) / INVERSE_STEP_MV, 0.0f,
+                               (float)INVERSE_STEPS);
+    uint8_t index = min((uint8_t)position, (uint8_t)(INVERSE_STEPS - 1));
+    float fraction = position - index;
+    return (inverseSoc[index] + (inverseSoc[index + 1] - inverseSoc[index]) * fraction) / UINT16_MAX;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Open circuit voltage of the battery over the SOC, for the chemistry
+// fixed at build time:
+//   -DBATTERY_CHEMISTRY=CHEMISTRY_LFP (default), CHEMISTRY_LEAD_ACID or
+//                       CHEMISTRY_NMC
+//   -DBATTERY_CELLS=n   cells in series (default 16, a 48V LiFePO4 bank)
+//
+// The curves are per cell at 25 degrees after a few hours of rest, in
+// steps of 10% SOC. The step is fixed, so a lookup is an index and one
+// interpolation. The other way round a table over equal voltage steps is
+// built once, so ocvSoc() is constant time as well.
+
+#include <Arduino.h>
+
+#define CHEMISTRY_LFP 0
+#define CHEMISTRY_LEAD_ACID 1
+#define CHEMISTRY_NMC 2
+
+#ifndef BATTERY_CHEMISTRY
+#define BATTERY_CHEMISTRY CHEMISTRY_LFP
+#endif
+#ifndef BATTERY_CELLS
+#define BATTERY_CELLS 16
+#endif
+
+// soc from 0 to 1, in V for the whole battery
+float ocvVoltage(float soc);
+// dV/dSOC of the segment soc is in
+float ocvSlope(float soc);
+// SOC at an open circuit voltage in V, clamped to 0..1
+float ocvSoc(float voltage);
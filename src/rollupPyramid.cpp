@@ -0,0 +1,91 @@
+#include "rollupPyramid.h"
+#include "timeHandling.h"
+
+static const uint32_t PERIOD_S[RollupPyramid::NUM_LEVELS] = {1, 60, 3600, 86400};
+// A minute of seconds, two hours of minutes, two days of hours and a month
+static const uint16_t CAPACITY[RollupPyramid::NUM_LEVELS] = {60, 120, 48, 31};
+static const uint32_t SECOND_US = 1000000;
+
+RollupPyramid::RollupPyramid() {
+    static_assert(TOTAL_POINTS == 60 + 120 + 48 + 31, "CAPACITY and TOTAL_POINTS differ");
+    Point* storage = points;
+    memset(levels, 0, sizeof(levels));
+    for (uint8_t i = 0; i < NUM_LEVELS; ++i) {
+        levels[i].points = storage;
+        levels[i].open.reset();
+        storage += CAPACITY[i];
+    }
+}
+
+uint32_t RollupPyramid::periodSeconds(Level level) {
+    return PERIOD_S[level];
+}
+
+uint16_t RollupPyramid::capacity(Level level) {
+    return CAPACITY[level];
+}
+
+const RollupPyramid::Point& RollupPyramid::point(Level level, uint16_t index) const {
+    const Ring& ring = levels[level];
+    uint16_t oldest = ring.count == CAPACITY[level] ? ring.next : 0;
+    return ring.points[(oldest + index) % CAPACITY[level]];
+}
+
+void RollupPyramid::add(float current, float voltage, float duration) {
+    int32_t currentmA = lroundf(current * 1000.0f);
+    int32_t powermW = lroundf(current * voltage * 1000.0f);
+    uint32_t durationUs = lroundf(duration * 1000000.0f);
+    Accumulator& open = levels[LEVEL_SECOND].open;
+
+    if (currentmA < open.minmA) {
+        open.minmA = currentmA;
+    }
+    if (currentmA > open.maxmA) {
+        open.maxmA = currentmA;
+    }
+    // A long gap closes one second after the other
+    while (durationUs > 0) {
+        uint32_t part = min(durationUs, (uint32_t)(SECOND_US - open.durationUs));
+        open.charge += (int64_t)currentmA * part;
+        open.energy += (int64_t)powermW * part;
+        open.durationUs += part;
+        durationUs -= part;
+        if (open.durationUs >= SECOND_US) {
+            close(LEVEL_SECOND);
+            if (durationUs > 0) {
+                open.minmA = open.maxmA = currentmA;
+            }
+        }
+    }
+}
+
+// Stores the open bucket of a level and merges it into the next one
+void RollupPyramid::close(uint8_t level) {
+    Ring& ring = levels[level];
+    Accumulator& open = ring.open;
+    Point& point = ring.points[ring.next];
+
+    // nAs / us = mA
+    point.currentmA = open.durationUs ? open.charge / (int64_t)open.durationUs : 0;
+    point.minmA = open.minmA;
+    point.maxmA = open.maxmA;
+    point.energyWh = open.energy * (1e-9f / 3600.0f);
+    ring.next = (ring.next + 1) % CAPACITY[level];
+    if (ring.count < CAPACITY[level]) {
+        ++ring.count;
+    }
+    ring.lastCloseMs = uptimeMillis();
+
+    if (level + 1 < NUM_LEVELS) {
+        Accumulator& parent = levels[level + 1].open;
+        parent.charge += open.charge;
+        parent.energy += open.energy;
+        parent.durationUs += open.durationUs;
+        parent.minmA = min(parent.minmA, open.minmA);
+        parent.maxmA = max(parent.maxmA, open.maxmA);
+        if (++parent.children == PERIOD_S[level + 1] / PERIOD_S[level]) {
+            close(level + 1);
+        }
+    }
+    open.reset();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Rollups of the battery current at 1s, 1min, 1h and 1day resolution.
+// A sample only touches the open second; a closed bucket is merged into
+// the open bucket of the next level, so a sample costs O(1) no matter how
+// many levels there are. The sums are integers (nAs, nWs, us) like in
+// CurrentStatistics, a day adds up without rounding.
+class RollupPyramid {
+public:
+    enum Level { LEVEL_SECOND = 0, LEVEL_MINUTE, LEVEL_HOUR, LEVEL_DAY, NUM_LEVELS };
+
+    struct Point {
+        // Time weighted mean, minimum and maximum current in mA
+        int32_t currentmA;
+        int32_t minmA;
+        int32_t maxmA;
+        // Positive when charging
+        float energyWh;
+    };
+
+    RollupPyramid();
+
+    // current in A and voltage in V, held for duration s
+    void add(float current, float voltage, float duration);
+
+    static uint32_t periodSeconds(Level level);
+    static uint16_t capacity(Level level);
+    uint16_t count(Level level) const { return levels[level].count; }
+    // Index 0 is the oldest point
+    const Point& point(Level level, uint16_t index) const;
+    // Uptime when the newest point of the level was closed
+    uint64_t lastCloseMs(Level level) const { return levels[level].lastCloseMs; }
+
+private:
+    struct Accumulator {
+        int64_t charge; // nAs
+        int64_t energy; // nWs
+        uint64_t durationUs;
+        int32_t minmA;
+        int32_t maxmA;
+        // Closed buckets of the level below
+        uint16_t children;
+
+        void reset() {
+            charge = energy = 0;
+            durationUs = 0;
+            minmA = INT32_MAX;
+            maxmA = INT32_MIN;
+            children = 0;
+        }
+    };
+
+    struct Ring {
+        Point* points;
+        uint16_t next;
+        uint16_t count;
+        uint64_t lastCloseMs;
+        Accumulator open;
+    };
+
+    void close(uint8_t level);
+
+    // All levels, see capacity(). About 4kB.
+    static const uint16_t TOTAL_POINTS = 259;
+
+    Point points[TOTAL_POINTS];
+    Ring levels[NUM_LEVELS];
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Lock free single producer / single consumer ring buffer.
+// The producer (the alert ISR or the capture task) only ever writes head,
+// the consumer (sensorLoop) only ever writes tail, so no locking is needed.
+// SIZE has to be a power of two.
+template <typename T, uint16_t SIZE>
+class SampleRing {
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+public:
+    // Producer side. Returns false and counts the sample as dropped if the
+    // consumer did not keep up. Always inlined, so an IRAM ISR can call it.
+    __attribute__((always_inline)) bool push(const T& value) {
+        uint16_t head = headIndex;
+        if ((uint16_t)(head - tailIndex) >= SIZE) {
+            ++droppedCount;
+            return false;
+        }
+        buffer[head & (SIZE - 1)] = value;
+        // Make sure the data is visible before the new head
+        __sync_synchronize();
+        headIndex = head + 1;
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& value) {
+        uint16_t tail = tailIndex;
+        if (tail == headIndex) {
+            return false;
+        }
+        __sync_synchronize();
+        value = buffer[tail & (SIZE - 1)];
+        __sync_synchronize();
+        tailIndex = tail + 1;
+        return true;
+    }
+
+    uint16_t size() const { return (uint16_t)(headIndex - tailIndex); }
+    bool isEmpty() const { return headIndex == tailIndex; }
+    // Total number of samples the producer had to throw away
+    uint32_t dropped() const { return droppedCount; }
+
+private:
+    T buffer[SIZE];
+    volatile uint16_t headIndex = 0;
+    volatile uint16_t tailIndex = 0;
+    volatile uint32_t droppedCount = 0;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+// INA226 configuration fixed at build time. Everything derived from it
+// (configuration register, time between two conversions, shunt LSB) is
+// constexpr, so nothing has to be looked up or divided per sample.
+//
+// The defaults can be overridden per env in platformio.ini:
+//   -DSENSOR_AVERAGES=INA226_AVERAGES_64
+//   -DSENSOR_BUS_CONV_TIME=INA226_BUS_CONV_TIME_2116US
+//   -DSENSOR_SHUNT_CONV_TIME=INA226_SHUNT_CONV_TIME_2116US
+//   -DSENSOR_MODE=INA226_MODE_SHUNT_BUS_CONT
+//   -DSENSOR_SHUNT_PRESET=n   index into SHUNT_PRESETS, fixes the shunt
+//                             instead of taking it from the web config
+
+#include <Arduino.h>
+#include <INA226.h>
+
+#ifndef SENSOR_AVERAGES
+#define SENSOR_AVERAGES INA226_AVERAGES_64
+#endif
+#ifndef SENSOR_BUS_CONV_TIME
+#define SENSOR_BUS_CONV_TIME INA226_BUS_CONV_TIME_2116US
+#endif
+#ifndef SENSOR_SHUNT_CONV_TIME
+#define SENSOR_SHUNT_CONV_TIME INA226_SHUNT_CONV_TIME_2116US
+#endif
+#ifndef SENSOR_MODE
+#define SENSOR_MODE INA226_MODE_SHUNT_BUS_CONT
+#endif
+
+struct Shunt {
+    float resistance;
+    float maxCurrent;
+};
+
+// The shunts a PZEM-017 knows, the Modbus shunt register selects one of
+// them. All of them have 75mV at the nominal current.
+constexpr Shunt SHUNT_PRESETS[] = {{0.00075f, 100}, {0.0015f, 50}, {0.000375f, 200}, {0.000250f, 300}};
+constexpr uint8_t NUM_SHUNT_PRESETS = sizeof(SHUNT_PRESETS) / sizeof(Shunt);
+
+constexpr float SHUNT_VOLTAGE_LSB = 0.0000025f;
+constexpr float BUS_VOLTAGE_LSB = 0.00125f;
+
+// Conversion time in us, indexed by the bus or shunt CT bits
+constexpr uint16_t CONVERSION_TIMES_US[] = {140, 204, 332, 588, 1100, 2116, 4156, 8244};
+// Number of averaged conversions, indexed by the AVG bits
+constexpr uint16_t AVERAGE_COUNTS[] = {1, 4, 16, 64, 128, 256, 512, 1024};
+
+constexpr uint16_t conversionTimeUs(uint8_t bits) {
+    return CONVERSION_TIMES_US[bits & 7];
+}
+
+constexpr uint16_t averageCount(uint8_t bits) {
+    return AVERAGE_COUNTS[bits & 7];
+}
+
+// INA226 averaging, conversion times and mode
+struct Profile {
+    ina226_averages_t averages;
+    ina226_busConvTime_t busConvTime;
+    ina226_shuntConvTime_t shuntConvTime;
+    ina226_mode_t mode;
+};
+
+// Value of the configuration register
+constexpr uint16_t profileConfig(const Profile& profile) {
+    return (profile.averages << 9) | (profile.busConvTime << 6) | (profile.shuntConvTime << 3) | profile.mode;
+}
+
+// Time between two conversions in s. Bit 0 of the mode enables the shunt,
+// bit 1 the bus conversion.
+constexpr float profilePeriod(const Profile& profile) {
+    return averageCount(profile.averages) *
+           (((profile.mode & 1) ? conversionTimeUs(profile.shuntConvTime) : 0) +
+            ((profile.mode & 2) ? conversionTimeUs(profile.busConvTime) : 0)) *
+           0.000001f;
+}
+
+constexpr Profile SENSOR_PROFILE = {SENSOR_AVERAGES, SENSOR_BUS_CONV_TIME, SENSOR_SHUNT_CONV_TIME, SENSOR_MODE};
+
+static_assert(SENSOR_MODE == INA226_MODE_SHUNT_CONT || SENSOR_MODE == INA226_MODE_SHUNT_BUS_CONT,
+              "The sensor has to convert the shunt voltage continuously");
+
+#ifdef SENSOR_SHUNT_PRESET
+static_assert(SENSOR_SHUNT_PRESET < NUM_SHUNT_PRESETS, "Unknown shunt preset");
+constexpr Shunt SENSOR_SHUNT = SHUNT_PRESETS[SENSOR_SHUNT_PRESET];
+// A per shunt voltage LSB, before the calibration factor
+constexpr float SENSOR_CURRENT_LSB = SHUNT_VOLTAGE_LSB / SENSOR_SHUNT.resistance;
+#endif
@@ -5,13 +5,18 @@
 
 #include "common.h"
 #include "sensorHandling.h"
+#include "sensorConfig.h"
 #include "statusHandling.h"
+#include "historyHandling.h"
+#include "sampleRing.h"
+#include "temperatureSource.h"
+#include "timeHandling.h"
 
 #if CONFIG_IDF_TARGET_ESP32S2
 #define PIN_SCL SCL
 #define PIN_SDA SDA
 #define PIN_INTERRUPT 7
-#elif defined(ESP8266)
+#elif defined(ESP8266) || defined(NATIVE_BUILD)
 #define PIN_SCL D1
 #define PIN_SDA D2
 #define PIN_INTERRUPT D5
@@ -21,211 +26,360 @@
 
 
 
-struct Shunt {
-  float resistance;
-  float maxCurrent;
+#ifndef SENSOR_RING_SIZE
+#ifdef SENSOR_ADAPTIVE_PROFILE
+// The fast profile produces a sample every 19ms, this covers 5s
+#define SENSOR_RING_SIZE 256
+#else
+// At the default 270ms per sample this covers 17s of a blocked loop
+#define SENSOR_RING_SIZE 64
+#endif
+#endif
+
+// Raw register values of one conversion, as captured by the producer
+struct Sample {
+    uint32_t timeUs;
+    int16_t shunt;
+    uint16_t bus;
+    // Acquisition profile the conversion was made with
+    uint8_t profile;
+    uint8_t sensor;
 };
 
+// The first one is the build configuration from sensorConfig.h. With
+// SENSOR_ADAPTIVE_PROFILE the sensor switches to the fast one while the
+// current changes quickly.
+static constexpr Profile profiles[] = {
+    // 64 * (2116us + 2116us) = 271ms by default
+    SENSOR_PROFILE,
+    // 16 * (588us + 588us) = 19ms
+    {INA226_AVERAGES_16, INA226_BUS_CONV_TIME_588US, INA226_SHUNT_CONV_TIME_588US, INA226_MODE_SHUNT_BUS_CONT}};
+// Nominal time between two conversions in s and configuration register
+static constexpr float PROFILE_PERIODS[] = {profilePeriod(profiles[0]), profilePeriod(profiles[1])};
+static constexpr uint16_t PROFILE_CONFIGS[] = {profileConfig(profiles[0]), profileConfig(profiles[1])};
+
+// No averaging and the shortest conversion time, shunt only
+static constexpr Profile TRANSIENT_PROFILE = {INA226_AVERAGES_1, INA226_BUS_CONV_TIME_140US,
+                                              INA226_SHUNT_CONV_TIME_140US, INA226_MODE_SHUNT_CONT};
+
+enum { PROFILE_STEADY = 0, PROFILE_FAST = 1 };
+
+#ifdef SENSOR_ADAPTIVE_PROFILE
+// Switch to the fast profile if the current changes faster than this (A/s)
+static const float FAST_PROFILE_SLOPE = 10.0f;
+// Stay there until it changed slower than this (A/s) for HOLD_US
+static const float STEADY_PROFILE_SLOPE = 2.0f;
+static const uint32_t STEADY_PROFILE_HOLD_US = 5000000;
+#endif
+
+#ifndef TRANSIENT_SIZE
+// Points of a transient recording, 8 bytes each
+#define TRANSIENT_SIZE 512
+#endif
+// Regular samples before the trigger that go into a transient recording
+#define TRANSIENT_PRE_TRIGGER 16
+
+// Manufacturer ID register, reads "TI" on every INA226
+static const uint8_t REG_MANUFACTURER_ID = 0xFE;
+static const uint16_t MANUFACTURER_ID_TI = 0x5449;
+
 
 volatile uint16_t alertCounter = 0;
-double sampleTime = 0;
 bool gSensorInitialized=false;
 
-Shunt PZEM017ShuntData[4] = {
-    {0.00075, 100}, {0.0015, 50}, {0.000375, 200}, {0.000250, 300}};
+// The INA226 oscillator is only accurate to a few percent, so the period
+// between two conversions is learned from the sample timestamps.
+// The estimate may move this far away from the datasheet value.
+static const float MAX_PERIOD_DEVIATION = 0.1f;
+// Weight of a new interval in the running estimate
+static const float PERIOD_ALPHA = 1.0f / 64.0f;
+
+// I2C addresses of the sensors. These are the ones the usual breakout
+// boards can be jumpered to (A0/A1 at GND or VS).
+static const uint8_t SENSOR_ADDRESSES[] = {0x40, 0x41, 0x44, 0x45};
+
+struct Sensor {
+    uint8_t address;
+    bool present;
+    BatteryStatus* battery;
+
+    // Producer side
+    // The register the INA226 pointer is set to. A read of the same
+    // register again doesn't need the pointer write. 0xFF means unknown,
+    // e.g. after the library talked to the chip.
+    uint8_t registerPointer;
+    // The profile the chip is configured with and the one the consumer
+    // wants. Only the code reading the samples talks to the chip, so it
+    // applies the change.
+    volatile uint8_t activeProfile;
+    volatile uint8_t requestedProfile;
+
+    // Consumer side
+    // Learned time between two conversions in s
+    float estimatedPeriod;
+    uint32_t lastSampleUs;
+    bool haveLastSample;
+    // Profile of the samples processSample() currently gets
+    uint8_t sampleProfile;
+    // The chip was reconfigured since the last sample
+    bool sampleRestarted;
+    // The period the last sample stands for
+    float lastSamplePeriod;
+    float lastSampleCurrent;
+#ifdef SENSOR_ADAPTIVE_PROFILE
+    uint32_t lastTransientUs;
+#endif
+    // History for the pre trigger part of a transient recording
+    TransientPoint preTrigger[TRANSIENT_PRE_TRIGGER];
+    uint8_t preTriggerIndex;
+};
+
+static Sensor sensors[NUM_SENSORS];
+
+// Transient recording. The regular samples before the trigger, followed
+// by the shunt voltage read as fast as the bus allows.
+static TransientHeader transientHeader = {{'I', 'N', 'R', 'T'}, 0, 0, 0, 0, 0, 0, {0, 0, 0}};
+static TransientPoint transientPoints[TRANSIENT_SIZE];
+// Sensor that triggered a recording, -1 if none
+static int8_t transientTriggered = -1;
+
+// Raw register value to A and V, including the calibration factors
+static float currentFactor = 0;
+static float voltageFactor = 0;
 
 static INA226 ina(Wire);
 
+// Time spent on I2C per sample in us
+static volatile uint32_t i2cTimeUs = 0;
+static volatile uint32_t i2cTimeMaxUs = 0;
+// Longest gap between two passes of sensorLoop() in us
+static uint32_t loopStallMaxUs = 0;
+
+// The library reads every register with a pointer write, a read and an
+// extra empty transmission, and waits in between. That must not happen in
+// an ISR and is slow anyway, so the sample registers are read directly.
+static bool readRegister(Sensor& sensor, uint8_t reg, uint16_t& value) {
+    if (sensor.registerPointer != reg) {
+        Wire.beginTransmission(sensor.address);
+        Wire.write(reg);
+        // Repeated start, the read follows right away
+        if (Wire.endTransmission(false) != 0) {
+            sensor.registerPointer = 0xFF;
+            return false;
+        }
+        sensor.registerPointer = reg;
+    }
+    if (Wire.requestFrom(sensor.address, (uint8_t)2) != 2) {
+        return false;
+    }
+    value = Wire.read() << 8;
+    value |= Wire.read();
+    return true;
+}
+
+static bool writeRegister(Sensor& sensor, uint8_t reg, uint16_t value) {
+    Wire.beginTransmission(sensor.address);
+    Wire.write(reg);
+    Wire.write(value >> 8);
+    Wire.write(value & 0xFF);
+    sensor.registerPointer = reg;
+    return Wire.endTransmission() == 0;
+}
+
+// Reads one conversion with as little bus traffic as possible.
+// With a single sensor the data register the pointer still points to is
+// read first, then Mask/Enable (which clears the flag and releases ALERT),
+// then the other data register. So the pointer alternates between shunt
+// and bus register and every sample costs 5 transactions instead of 6.
+// With several sensors on the ALERT line any of them may be the one that
+// is ready, so Mask/Enable comes first and a sensor without a new
+// conversion costs one or two transactions.
+static bool readSample(Sensor& sensor, Sample& sample) {
+    uint16_t mask;
+    uint16_t shunt;
+    bool ok;
+    uint32_t start = micros();
+
+#if NUM_SENSORS > 1
+    if (!readRegister(sensor, INA226_REG_MASKENABLE, mask) || !(mask & INA226_BIT_CVRF)) {
+        return false;
+    }
+    if (sensor.registerPointer == INA226_REG_BUSVOLTAGE) {
+        ok = readRegister(sensor, INA226_REG_BUSVOLTAGE, sample.bus) &&
+             readRegister(sensor, INA226_REG_SHUNTVOLTAGE, shunt);
+    } else {
+        ok = readRegister(sensor, INA226_REG_SHUNTVOLTAGE, shunt) &&
+             readRegister(sensor, INA226_REG_BUSVOLTAGE, sample.bus);
+    }
+#else
+    if (sensor.registerPointer == INA226_REG_BUSVOLTAGE) {
+        ok = readRegister(sensor, INA226_REG_BUSVOLTAGE, sample.bus) &&
+             readRegister(sensor, INA226_REG_MASKENABLE, mask) &&
+             readRegister(sensor, INA226_REG_SHUNTVOLTAGE, shunt);
+    } else {
+        ok = readRegister(sensor, INA226_REG_SHUNTVOLTAGE, shunt) &&
+             readRegister(sensor, INA226_REG_MASKENABLE, mask) &&
+             readRegister(sensor, INA226_REG_BUSVOLTAGE, sample.bus);
+    }
+#endif
+    sample.timeUs = start;
+    sample.shunt = (int16_t)shunt;
+    sample.profile = sensor.activeProfile;
+    sample.sensor = &sensor - sensors;
+
+    uint32_t duration = micros() - start;
+    // Running average over 16 samples
+    i2cTimeUs = i2cTimeUs + (((int32_t)duration - (int32_t)i2cTimeUs) >> 4);
+    if (duration > i2cTimeMaxUs) {
+        i2cTimeMaxUs = duration;
+    }
+
+    if (sensor.requestedProfile != sensor.activeProfile) {
+        // This restarts the running conversion, the next sample is the
+        // first one with the new profile.
+        writeRegister(sensor, INA226_REG_CONFIG, PROFILE_CONFIGS[sensor.requestedProfile]);
+        sensor.activeProfile = sensor.requestedProfile;
+    }
+    return ok && (mask & INA226_BIT_CVRF);
+}
+
+#ifndef SENSOR_ISR_CAPTURE
+// Releases ALERT of every sensor without taking a sample
+static void releaseAlert() {
+    uint16_t mask;
+    for (Sensor& sensor : sensors) {
+        if (sensor.present) {
+            readRegister(sensor, INA226_REG_MASKENABLE, mask);
+        }
+    }
+}
+#endif
+
+uint32_t sensorI2cTimeUs() {
+    return i2cTimeUs;
+}
+
+uint32_t sensorI2cTimeMaxUs() {
+    return i2cTimeMaxUs;
+}
+
+void sensorUpdateParameters() {
+    for (BatteryStatus& battery : gBatteries) {
+        battery.setParameters(gCapacityAh,gChargeEfficiencyPercent,gMinPercent,gTailCurrentmA,gFullVoltagemV,gFullDelayS);
+        battery.setAlarms(gLowVoltageAlarmmV, gHighVoltageAlarmmV);
+        battery.setRest(gRestCurrentmA, gRestTimeMin);
+        battery.setLearning(gUseLearnedCapacity);
+        battery.setTtgModel(gPeukertExponent, gTemperatureCoefficient);
+        battery.setTtgProfile(gTtgFromProfile);
+    }
+}
+
+uint32_t sensorLoopStallMaxUs() {
+    return loopStallMaxUs;
+}
+
+#ifdef SENSOR_ISR_CAPTURE
+static SampleRing<Sample, SENSOR_RING_SIZE> sampleRing;
+
+// Producer: Reads the sensors with a new conversion and pushes their
+// samples into the ring. The ALERT line is shared, if a sensor got ready
+// during the pass it is still low and there won't be another edge, so
+// the pass is repeated. edgeUs is the time of the alert if it is known,
+// with a single sensor that is when the conversion finished.
+static void captureSample(uint32_t edgeUs = 0) {
+    Sample sample;
+    uint8_t passes = 0;
+    do {
+        for (Sensor& sensor : sensors) {
+            if (sensor.present && readSample(sensor, sample)) {
+                if (NUM_SENSORS == 1 && edgeUs) {
+                    sample.timeUs = edgeUs;
+                }
+                sampleRing.push(sample);
+            }
+        }
+    } while (NUM_SENSORS > 1 && digitalRead(PIN_INTERRUPT) == LOW && ++passes < NUM_SENSORS);
+}
+
+#ifdef ESP32
+// On the ESP32 the I2C driver can't be used from an ISR. A high priority
+// task does the reading instead, it preempts loop() as soon as the ISR
+// wakes it.
+static TaskHandle_t captureTask = 0;
+
+static void captureLoop(void*) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        captureSample();
+    }
+}
+
+IRAM_ATTR void alert(void) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(captureTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+#else
+// On the ESP8266 the ISR only notes the time of the edge, the samples are
+// read in the loop. The I2C driver runs from flash, which is unmapped
+// whenever anything writes the flash (journal, config saves, the SDK's
+// WiFi settings, OTA), and a read of several sensors would keep the
+// interrupts off for too long.
+static SampleRing<uint32_t, SENSOR_RING_SIZE> alertRing;
+
+IRAM_ATTR void alert(void) { alertRing.push(micros()); }
+
+// Reads what the edges since the last call announced. The chip only holds
+// the latest conversion, missed ones show up as a longer interval.
+static void captureAlerts() {
+    uint32_t edgeUs = 0;
+    bool edge = false;
+    while (alertRing.pop(edgeUs)) {
+        edge = true;
+    }
+    // A shared ALERT line that stayed low doesn't give another edge
+    if (edge || (NUM_SENSORS > 1 && digitalRead(PIN_INTERRUPT) == LOW)) {
+        captureSample(edgeUs);
+    }
+}
+#endif
+
+#else
 IRAM_ATTR void alert(void) { ++alertCounter; }
+#endif
 
-uint16_t translateConversionTime(ina226_shuntConvTime_t time) {
-    uint16_t result = 0;
-    switch (time) {
-        case INA226_BUS_CONV_TIME_140US:
-        result = 140;
-        break;
-        case INA226_BUS_CONV_TIME_204US:
-        result = 204;
-        break;
-        case INA226_BUS_CONV_TIME_332US:
-        result = 332;
-        break;
-        case INA226_BUS_CONV_TIME_588US:
-        result = 558;
-        break;
-        case INA226_BUS_CONV_TIME_1100US:
-        result = 1100;
-        break;
-        case INA226_BUS_CONV_TIME_2116US:
-        result = 2116;
-        break;
-        case INA226_BUS_CONV_TIME_4156US:
-        result = 4156;
-        break;
-        case INA226_BUS_CONV_TIME_8244US:
-        result = 8244;
-        break;
-        default:
-        result = 0;
-    }
-    return result;
+static void armAlert() {
+    attachInterrupt(digitalPinToInterrupt(PIN_INTERRUPT), alert, FALLING);
+    // ALERT might already be low, which means we would never see an edge.
+    // Reading Mask/Enable once releases it.
+#if defined(SENSOR_ISR_CAPTURE) && defined(ESP32)
+    xTaskNotifyGive(captureTask);
+#elif defined(SENSOR_ISR_CAPTURE)
+    captureSample();
+#else
+    releaseAlert();
+#endif
 }
 
-uint16_t translateSampleCount(ina226_averages_t value) {
-    uint16_t result = 0;
-    switch (value) {
-        case INA226_AVERAGES_1:
-        result = 1;
-        break;
-        case INA226_AVERAGES_4:
-        result = 4;
-        break;
-        case INA226_AVERAGES_16:
-        result = 16;
-        break;
-        case INA226_AVERAGES_64:
-        result = 64;
-        break;
-        case INA226_AVERAGES_128:
-        result = 128;
-        break;
-        case INA226_AVERAGES_256:
-        result = 256;
-        break;
-        case INA226_AVERAGES_512:
-        result = 512;
-        break;
-        case INA226_AVERAGES_1024:
-        result = 1024;
-        break;
-        default:
-        result = 0;
-    }
-
-  return result;
+#ifdef SENSOR_ISR_CAPTURE
+static void startCapture() {
+#ifdef ESP32
+    xTaskCreate(captureLoop, "capture", 2048, 0, configMAX_PRIORITIES - 1, &captureTask);
+#endif
+    armAlert();
 }
+#endif
 
 #ifdef DEBUG_SENSOR
+static const char* const MODE_NAMES[] = {
+    "Power-Down",        "Shunt Voltage, Triggered", "Bus Voltage, Triggered",  "Shunt and Bus, Triggered",
+    "ADC Off",           "Shunt Voltage, Continuous", "Bus Voltage, Continuous", "Shunt and Bus, Continuous"};
+
 void checkConfig() {
-    SERIAL_DBG_DBG.print("Mode:                  ");
-    switch (ina.getMode()) {
-        case INA226_MODE_POWER_DOWN:
-        SERIAL_DBG.println("Power-Down");
-        break;
-        case INA226_MODE_SHUNT_TRIG:
-        SERIAL_DBG.println("Shunt Voltage, Triggered");
-        break;
-        case INA226_MODE_BUS_TRIG:
-        SERIAL_DBG.println("Bus Voltage, Triggered");
-        break;
-        case INA226_MODE_SHUNT_BUS_TRIG:
-        SERIAL_DBG.println("Shunt and Bus, Triggered");
-        break;
-        case INA226_MODE_ADC_OFF:
-        SERIAL_DBG.println("ADC Off");
-        break;
-        case INA226_MODE_SHUNT_CONT:
-        SERIAL_DBG.println("Shunt Voltage, Continuous");
-        break;
-        case INA226_MODE_BUS_CONT:
-        SERIAL_DBG.println("Bus Voltage, Continuous");
-        break;
-        case INA226_MODE_SHUNT_BUS_CONT:
-        SERIAL_DBG.println("Shunt and Bus, Continuous");
-        break;
-        default:
-        SERIAL_DBG.println("unknown");
-    }
-
-    SERIAL_DBG.print("Samples average:       ");
-    switch (ina.getAverages()) {
-        case INA226_AVERAGES_1:
-        SERIAL_DBG.println("1 sample");
-        break;
-        case INA226_AVERAGES_4:
-        SERIAL_DBG.println("4 samples");
-        break;
-        case INA226_AVERAGES_16:
-        SERIAL_DBG.println("16 samples");
-        break;
-        case INA226_AVERAGES_64:
-        SERIAL_DBG.println("64 samples");
-        break;
-        case INA226_AVERAGES_128:
-        SERIAL_DBG.println("128 samples");
-        break;
-        case INA226_AVERAGES_256:
-        SERIAL_DBG.println("256 samples");
-        break;
-        case INA226_AVERAGES_512:
-        SERIAL_DBG.println("512 samples");
-        break;
-        case INA226_AVERAGES_1024:
-        SERIAL_DBG.println("1024 samples");
-        break;
-        default:
-        SERIAL_DBG.println("unknown");
-    }
-
-    SERIAL_DBG.print("Bus conversion time:   ");
-    switch (ina.getBusConversionTime()) {
-        case INA226_BUS_CONV_TIME_140US:
-        SERIAL_DBG.println("140uS");
-        break;
-        case INA226_BUS_CONV_TIME_204US:
-        SERIAL_DBG.println("204uS");
-        break;
-        case INA226_BUS_CONV_TIME_332US:
-        SERIAL_DBG.println("332uS");
-        break;
-        case INA226_BUS_CONV_TIME_588US:
-        SERIAL_DBG.println("558uS");
-        break;
-        case INA226_BUS_CONV_TIME_1100US:
-        SERIAL_DBG.println("1.100ms");
-        break;
-        case INA226_BUS_CONV_TIME_2116US:
-        SERIAL_DBG.println("2.116ms");
-        break;
-        case INA226_BUS_CONV_TIME_4156US:
-        SERIAL_DBG.println("4.156ms");
-        break;
-        case INA226_BUS_CONV_TIME_8244US:
-        SERIAL_DBG.println("8.244ms");
-        break;
-        default:
-        SERIAL_DBG.println("unknown");
-    }
-
-    SERIAL_DBG.print("Shunt conversion time: ");
-    switch (ina.getShuntConversionTime()) {
-        case INA226_SHUNT_CONV_TIME_140US:
-        SERIAL_DBG.println("140uS");
-        break;
-        case INA226_SHUNT_CONV_TIME_204US:
-        SERIAL_DBG.println("204uS");
-        break;
-        case INA226_SHUNT_CONV_TIME_332US:
-        SERIAL_DBG.println("332uS");
-        break;
-        case INA226_SHUNT_CONV_TIME_588US:
-        SERIAL_DBG.println("558uS");
-        break;
-        case INA226_SHUNT_CONV_TIME_1100US:
-        SERIAL_DBG.println("1.100ms");
-        break;
-        case INA226_SHUNT_CONV_TIME_2116US:
-        SERIAL_DBG.println("2.116ms");
-        break;
-        case INA226_SHUNT_CONV_TIME_4156US:
-        SERIAL_DBG.println("4.156ms");
-        break;
-        case INA226_SHUNT_CONV_TIME_8244US:
-        SERIAL_DBG.println("8.244ms");
-        break;
-        default:
-        SERIAL_DBG.println("unknown");
-    }
+    SERIAL_DBG.printf("Mode:                  %s\n", MODE_NAMES[ina.getMode() & 7]);
+    SERIAL_DBG.printf("Samples average:       %u\n", averageCount(ina.getAverages()));
+    SERIAL_DBG.printf("Bus conversion time:   %uus\n", conversionTimeUs(ina.getBusConversionTime()));
+    SERIAL_DBG.printf("Shunt conversion time: %uus\n", conversionTimeUs(ina.getShuntConversionTime()));
 
     SERIAL_DBG.print("Max possible current:  ");
     SERIAL_DBG.print(ina.getMaxPossibleCurrent());
@@ -246,96 +400,348 @@ void checkConfig() {
 }
 #endif
 
-void sensorSetShunt(uint16_t id) {
-    if(id < sizeof(PZEM017ShuntData)/ sizeof(Shunt)) {
-        gShuntResistancemR = PZEM017ShuntData[id].resistance * 1000.0f;
-        gMaxCurrentA = PZEM017ShuntData[id].maxCurrent;
+// Computes the factors from raw register values to A and V. Only the
+// calibration factors remain a runtime value with a shunt preset.
+static void updateScaling() {
+#ifdef SENSOR_SHUNT_PRESET
+    // The web config and Modbus can't change the shunt
+    gShuntResistancemR = SENSOR_SHUNT.resistance * 1000.0f;
+    gMaxCurrentA = SENSOR_SHUNT.maxCurrent;
+    currentFactor = SENSOR_CURRENT_LSB * gCurrentCalibrationFactor;
+#else
+    currentFactor = SHUNT_VOLTAGE_LSB / (gShuntResistancemR / 1000.0f) * gCurrentCalibrationFactor;
+#endif
+    voltageFactor = BUS_VOLTAGE_LSB * gVoltageCalibrationFactor;
+}
 
-        ina.calibrate(PZEM017ShuntData[id].resistance,PZEM017ShuntData[id].maxCurrent);
+void sensorSetShunt(uint16_t id) {
+    if(id < NUM_SHUNT_PRESETS) {
+        gShuntResistancemR = SHUNT_PRESETS[id].resistance * 1000.0f;
+        gMaxCurrentA = SHUNT_PRESETS[id].maxCurrent;
+        // The current is computed from the shunt voltage, the chip's
+        // calibration register is not used.
+        updateScaling();
     }
     
 }
 
-void setupSensor() {
-    // Default INA226 address is 0x40
-    gSensorInitialized = ina.begin();
+void setupSensor(Sensor& sensor) {
+    uint16_t id = 0;
+    sensor.registerPointer = 0xFF;
+    sensor.present = readRegister(sensor, REG_MANUFACTURER_ID, id) && id == MANUFACTURER_ID_TI;
 
     // Check if the connection was successful, stop if not
-    if (!gSensorInitialized) {
-        SERIAL_DBG.println("Connection to sensor failed");
-        
+    if (!sensor.present) {
+        SERIAL_DBG.printf("Connection to sensor 0x%02x failed\n", sensor.address);
+        return;
     }
     // Configure INA226
-    ina.configure(INA226_AVERAGES_64, INA226_BUS_CONV_TIME_2116US,
-                    INA226_SHUNT_CONV_TIME_2116US, INA226_MODE_SHUNT_BUS_CONT);
+    const Profile& profile = profiles[PROFILE_STEADY];
+    ina.begin(sensor.address);
+    ina.configure(profile.averages, profile.busConvTime, profile.shuntConvTime, profile.mode);
     ina.calibrate(gShuntResistancemR / 1000, gMaxCurrentA);    
     ina.enableConversionReadyAlert();
 
-    uint16_t conversionTimeShunt =
-        translateConversionTime(ina.getShuntConversionTime());
-    uint16_t conversionTimeBus = translateConversionTime(
-        (ina226_shuntConvTime_t)ina.getBusConversionTime());
-    uint16_t samples = translateSampleCount(ina.getAverages());
+    sensor.estimatedPeriod = PROFILE_PERIODS[PROFILE_STEADY];
+    sensor.activeProfile = sensor.requestedProfile = sensor.sampleProfile = PROFILE_STEADY;
+    sensor.registerPointer = 0xFF;
+    sensor.haveLastSample = false;
+
+#ifdef DEBUG_SENSOR
+    // Display configuration
+    checkConfig();
+#endif
+}
+
+float sensorSamplePeriod(uint8_t index) {
+    return sensors[index].estimatedPeriod;
+}
+
+// The trapezoid gives each sample half of the interval before and half of
+// the one after it. If the period changes, the sample before the change
+// has to get half of its own period, so the interval is split.
+static void integrateSwitch(Sensor& sensor, float current, float interval, float previousPeriod) {
+    float periodChange = (interval - previousPeriod) / 2;
+    if (periodChange < 0) {
+        sensor.battery->updateConsumption(sensor.lastSampleCurrent, -periodChange, 1);
+        sensor.battery->updateConsumption(current, interval, 1);
+    } else {
+        sensor.battery->updateConsumption(current, previousPeriod, 1);
+        sensor.battery->updateConsumption(current, periodChange, 1);
+    }
+}
+
+// Integrates one sample over the time that really passed since the
+// previous one. Gaps (missed or dropped conversions) are bridged with the
+// average of both samples and fed into the average window as several
+// periods.
+static void processSample(Sensor& sensor, uint32_t timeUs, uint8_t profile, float current, float voltage) {
+    float interval;
+    uint16_t numPeriods = 1;
+    bool switched = profile != sensor.sampleProfile;
+    bool first = !sensor.haveLastSample;
+
+    if (switched) {
+        // The clock error learned so far applies to the new profile as well
+        sensor.estimatedPeriod *= PROFILE_PERIODS[profile] / PROFILE_PERIODS[sensor.sampleProfile];
+        sensor.sampleProfile = profile;
+    }
+    interval = sensor.estimatedPeriod;
+
+    if (sensor.haveLastSample) {
+        interval = (uint32_t)(timeUs - sensor.lastSampleUs) * 0.000001f;
+        numPeriods = constrain(lroundf(interval / sensor.estimatedPeriod), 1L, 1000L);
+        if (switched || sensor.sampleRestarted) {
+            // This interval contains the reconfiguration, don't learn from it
+        } else if (numPeriods == 1) {
+            sensor.estimatedPeriod += (interval - sensor.estimatedPeriod) * PERIOD_ALPHA;
+            sensor.estimatedPeriod = constrain(sensor.estimatedPeriod, PROFILE_PERIODS[profile] * (1.0f - MAX_PERIOD_DEVIATION),
+                                               PROFILE_PERIODS[profile] * (1.0f + MAX_PERIOD_DEVIATION));
+        } else {
+            SERIAL_DBG.printf("Overflow %d\n", numPeriods);
+        }
+    }
+    sensor.battery->setVoltage(voltage);
+    if ((switched || sensor.sampleRestarted) && !first && numPeriods == 1) {
+        integrateSwitch(sensor, current, interval, sensor.lastSamplePeriod);
+    } else {
+        sensor.battery->updateConsumption(current, interval / numPeriods, numPeriods);
+    }
+    if (sensor.battery == &gBattery) {
+        historyAddSample(current, voltage, interval);
+    }
+    sensor.lastSampleUs = timeUs;
+    sensor.lastSamplePeriod = sensor.estimatedPeriod;
+    sensor.haveLastSample = true;
+    sensor.sampleRestarted = false;
+
+#ifdef SENSOR_ADAPTIVE_PROFILE
+    float slope = first ? 0 : fabsf(current - sensor.lastSampleCurrent) / interval;
+    if (slope >= FAST_PROFILE_SLOPE) {
+        sensor.lastTransientUs = timeUs;
+        sensor.requestedProfile = PROFILE_FAST;
+    } else if (sensor.requestedProfile == PROFILE_FAST) {
+        if (slope >= STEADY_PROFILE_SLOPE) {
+            sensor.lastTransientUs = timeUs;
+        } else if (timeUs - sensor.lastTransientUs >= STEADY_PROFILE_HOLD_US) {
+            sensor.requestedProfile = PROFILE_STEADY;
+        }
+    }
+#endif
+    sensor.lastSampleCurrent = current;
+}
+
+// Keeps the history for the pre trigger part and checks the trigger
+static void handleSample(const Sample& sample) {
+    Sensor& sensor = sensors[sample.sensor];
+    float current = sample.shunt * currentFactor;
+    float threshold = gTransientThresholdA;
+    bool below = fabsf(sensor.lastSampleCurrent) < threshold;
+
+    processSample(sensor, sample.timeUs, sample.profile, current, sample.bus * voltageFactor);
+
+    sensor.preTrigger[sensor.preTriggerIndex] = {sample.timeUs, sample.shunt, sample.bus};
+    sensor.preTriggerIndex = (sensor.preTriggerIndex + 1) % TRANSIENT_PRE_TRIGGER;
+    if (threshold > 0 && below && fabsf(current) >= threshold && transientTriggered < 0) {
+        transientTriggered = sample.sensor;
+        transientHeader.triggerUs = sample.timeUs;
+    }
+}
 
-    // This is the time it takes to create a new measurement
-    sampleTime = (conversionTimeShunt + conversionTimeBus) * samples * 0.000001  ;
+// Reads the shunt voltage as fast as the bus allows, without averaging and
+// with the shortest conversion time. The bus voltage isn't converted in
+// this mode, every point gets the one of the trigger sample. Blocks for up
+// to gTransientDurationMs, the other sensors aren't read in the meantime.
+static void recordTransient() {
+    uint16_t count = 0;
+
+    // Nobody else may use the bus now
+    detachInterrupt(digitalPinToInterrupt(PIN_INTERRUPT));
+#ifdef SENSOR_ISR_CAPTURE
+    // Samples captured in the meantime have to be processed first
+    Sample sample;
+    while (sampleRing.pop(sample)) {
+        handleSample(sample);
+    }
+#endif
+    Sensor& sensor = sensors[transientTriggered];
+    transientHeader.sensor = transientTriggered;
+    transientTriggered = -1;
+    transientHeader.currentLsb = currentFactor;
+    transientHeader.voltageLsb = voltageFactor;
+
+    // The regular samples before the trigger, oldest first
+    for (uint8_t i = 0; i < TRANSIENT_PRE_TRIGGER; ++i) {
+        const TransientPoint& point = sensor.preTrigger[(sensor.preTriggerIndex + i) % TRANSIENT_PRE_TRIGGER];
+        if (point.timeUs != 0) {
+            transientPoints[count++] = point;
+        }
+    }
+    transientHeader.trigger = count;
+    uint16_t bus = count ? transientPoints[count - 1].bus : 0;
+
+    writeRegister(sensor, INA226_REG_CONFIG, profileConfig(TRANSIENT_PROFILE));
+    delayMicroseconds(conversionTimeUs(TRANSIENT_PROFILE.shuntConvTime));
+
+    uint32_t start = micros();
+    uint32_t durationUs = gTransientDurationMs * 1000UL;
+    double charge = 0;
+    float lastCurrent = sensor.lastSampleCurrent;
+    uint32_t lastUs = sensor.lastSampleUs;
+    uint16_t shunt;
+    while (count < TRANSIENT_SIZE && micros() - start < durationUs) {
+        uint32_t timeUs = micros();
+        if (!readRegister(sensor, INA226_REG_SHUNTVOLTAGE, shunt)) {
+            break;
+        }
+        transientPoints[count++] = {timeUs, (int16_t)shunt, bus};
+
+        float current = (int16_t)shunt * transientHeader.currentLsb;
+        charge += (lastCurrent + current) / 2 * ((uint32_t)(timeUs - lastUs) * 0.000001f);
+        lastCurrent = current;
+        lastUs = timeUs;
+    }
+    transientHeader.count = count;
+
+    // Back to the regular profile, the next conversion starts now
+    writeRegister(sensor, INA226_REG_CONFIG, PROFILE_CONFIGS[sensor.activeProfile]);
+    armAlert();
+
+    // The recording goes into the battery as a single sample of the average
+    // current
+    float period = (uint32_t)(lastUs - sensor.lastSampleUs) * 0.000001f;
+    if (period > 0) {
+        integrateSwitch(sensor, charge / period, period, sensor.lastSamplePeriod);
+        sensor.lastSampleUs = lastUs;
+        sensor.lastSamplePeriod = period;
+        sensor.lastSampleCurrent = charge / period;
+    }
+    sensor.sampleRestarted = true;
 }
 
 void sensorInit() {
     Wire.begin(PIN_SDA,PIN_SCL); 
-    attachInterrupt(digitalPinToInterrupt(PIN_INTERRUPT), alert, FALLING);
+    updateScaling();
+#ifdef I2C_FAST_MODE
+    // The INA226 supports fast mode, this cuts the time per sample
+    Wire.setClock(400000);
+#endif
+#if NUM_SENSORS > 1
+    pinMode(PIN_INTERRUPT, INPUT_PULLUP);
+#endif
 
-    setupSensor();
+    for (uint8_t i = 0; i < NUM_SENSORS; ++i) {
+        sensors[i].address = SENSOR_ADDRESSES[i];
+        sensors[i].battery = &gBatteries[i];
+        setupSensor(sensors[i]);
+        gBatteries[i].setParameters(gCapacityAh,gChargeEfficiencyPercent,gMinPercent,gTailCurrentmA,gFullVoltagemV,gFullDelayS);
+        gBatteries[i].setAlarms(gLowVoltageAlarmmV, gHighVoltageAlarmmV);
+        gBatteries[i].setRest(gRestCurrentmA, gRestTimeMin);
+        gBatteries[i].setLearning(gUseLearnedCapacity);
+        gBatteries[i].setTtgModel(gPeukertExponent, gTemperatureCoefficient);
+        gBatteries[i].setTtgProfile(gTtgFromProfile);
+    }
+    // Any sensor keeps the loop going, the others are skipped one by one
+    gSensorInitialized = false;
+    for (const Sensor& sensor : sensors) {
+        gSensorInitialized = gSensorInitialized || sensor.present;
+    }
+    statusJournalInit();
+    historyInit();
 
-#ifdef DEBUG_SENSOR
-    // Display configuration
-    checkConfig();
+#ifdef SENSOR_ISR_CAPTURE
+    // The producer owns the bus once the interrupt is attached
+    startCapture();
+#else
+    armAlert();
 #endif
-
-    gBattery.setParameters(gCapacityAh,gChargeEfficiencyPercent,gMinPercent,gTailCurrentmA,gFullVoltagemV,gFullDelayS);
 }
 
+// Consumer: Processes everything that has been captured since the last
+// call. Without SENSOR_ISR_CAPTURE the sensors are read here, all of them
+// in one pass.
 void updateAhCounter() {
-    int count;
+    Sample sample;
+
+#ifdef SENSOR_ISR_CAPTURE
+#ifndef ESP32
+    captureAlerts();
+#endif
+    while (sampleRing.pop(sample)) {
+        handleSample(sample);
+    }
+#else
+    // With a shared ALERT line it stays low if a sensor got ready while
+    // the others were read, there is no new edge then.
+    if (!alertCounter && (NUM_SENSORS == 1 || digitalRead(PIN_INTERRUPT) == HIGH)) {
+        return;
+    }
     noInterrupts();
-    // If we missed an interrupt, we assume we had thew same value
-    // alle the time.
-    count = alertCounter;
+    // Missed conversions show up as a longer interval in processSample()
     alertCounter = 0;
     interrupts();
 
-    //float shuntVoltage = ina.readShuntVoltage();
-    float current = ina.readShuntCurrent() * gCurrentCalibrationFactor;
-    //SERIAL_DBG.printf("current is: %.2f\n",current);
-    gBattery.updateConsumption(current,sampleTime,count);
-    if(count > 1) {
-        SERIAL_DBG.printf("Overflow %d\n",count);
-    } 
+    for (Sensor& sensor : sensors) {
+        if (sensor.present && readSample(sensor, sample)) {
+            handleSample(sample);
+        }
+    }
+#endif
+
+    if (transientTriggered >= 0) {
+        recordTransient();
+    }
+}
+
+const TransientHeader& sensorTransientHeader() {
+    return transientHeader;
+}
+
+const TransientPoint* sensorTransientPoints() {
+    return transientPoints;
+}
+
+bool sensorPresent(uint8_t index) {
+    return index < NUM_SENSORS && sensors[index].present;
 }
 
 void sensorLoop() {
-    static unsigned long lastUpdate = 0;
-    unsigned long now = millis();
+    static uint64_t lastUpdate = 0;
+    static uint32_t lastPassUs = 0;
+    uint64_t now = uptimeMillis();
+    uint32_t nowUs = micros();
 
     if(!gSensorInitialized) {
         return;
     }
 
-    if(gParamsChanged) {
-        ina.calibrate(gShuntResistancemR / 1000.0, gMaxCurrentA);    
-        gBattery.setParameters(gCapacityAh,gChargeEfficiencyPercent,gMinPercent,gTailCurrentmA,gFullVoltagemV,gFullDelayS);
+    // The first pass follows setup(), that isn't a stall
+    if (lastPassUs && nowUs - lastPassUs > loopStallMaxUs) {
+        loopStallMaxUs = nowUs - lastPassUs;
     }
+    lastPassUs = nowUs;
 
-    while (alertCounter && ina.isConversionReady()) {           
-        updateAhCounter();
-        gBattery.setVoltage(ina.readBusVoltage() * gVoltageCalibrationFactor);
+    if(gParamsChanged) {
+        updateScaling();
+        sensorUpdateParameters();
     }
+
+    updateAhCounter();
     
     if (now - lastUpdate >= UPDATE_INTERVAL) {
-        gBattery.checkFull();        
-        gBattery.updateSOC();        
-        gBattery.updateTtG();
-        gBattery.updateStats(now);
+        float celsius = temperatureRead();
+        for (uint8_t i = 0; i < NUM_SENSORS; ++i) {
+            if (sensors[i].present) {
+                gBatteries[i].checkFull();        
+                gBatteries[i].checkRest();
+                gBatteries[i].setTemperature(celsius);
+                gBatteries[i].updateSOC();        
+                gBatteries[i].updateTtG();
+                gBatteries[i].updateStats(now);
+            }
+        }
+        statusJournalLoop(now);
+        historyLoop(now);
         lastUpdate = now;
     }
 /*
@@ -1,9 +1,48 @@
 #pragma once
 
+#include <Arduino.h>
+
+// One point of a transient recording, raw INA226 register values
+struct TransientPoint {
+    uint32_t timeUs;
+    int16_t shunt;
+    uint16_t bus;
+};
+
+// Header of a transient recording, followed by count points
+struct TransientHeader {
+    char magic[4];
+    // Number of points, 0 if nothing was recorded yet
+    uint16_t count;
+    // Index of the first point after the trigger
+    uint16_t trigger;
+    // Time of the sample that triggered
+    uint32_t triggerUs;
+    // A per shunt LSB and V per bus LSB
+    float currentLsb;
+    float voltageLsb;
+    // Index of the sensor that was recorded
+    uint8_t sensor;
+    uint8_t reserved[3];
+};
 
 void sensorInit();
 void sensorLoop();
 void sensorSetShunt(uint16_t id);
+// Hands the battery settings of the configuration to all batteries
+void sensorUpdateParameters();
+// False if the sensor with this index didn't answer
+bool sensorPresent(uint8_t index);
+// Measured time between two conversions in s
+float sensorSamplePeriod(uint8_t index = 0);
+// Time spent on I2C per sample, running average and maximum in us
+uint32_t sensorI2cTimeUs();
+uint32_t sensorI2cTimeMaxUs();
+// Longest time between two calls of sensorLoop() in us
+uint32_t sensorLoopStallMaxUs();
+// The last transient recording
+const TransientHeader& sensorTransientHeader();
+const TransientPoint* sensorTransientPoints();
 
 extern float shuntResistance;
 extern float maxExpectedCurrent;
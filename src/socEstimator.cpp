@@ -0,0 +1,55 @@
+#include "socEstimator.h"
+#include "ocvCurve.h"
+
+static const float R0 = SOC_EKF_R0_MOHM / 1000.0f;
+static const float R1 = SOC_EKF_R1_MOHM / 1000.0f;
+static const float TAU = SOC_EKF_TAU_S;
+// Variance the counter adds per second, about 1% SOC per day
+static const float SOC_NOISE = 1.2e-9f;
+// The RC branch is a rough model, V^2 per second
+static const float RC_NOISE = 1e-6f;
+// Hysteresis, temperature and curve spread, 20mV per cell
+static const float VOLTAGE_NOISE = 0.02f * BATTERY_CELLS * 0.02f * BATTERY_CELLS;
+// Keeps the covariance positive definite with float rounding
+static const float MIN_VARIANCE = 1e-10f;
+
+SocEstimator::SocEstimator() : socState(0), rcVoltage(0), p00(1), p01(0), p11(0) {}
+
+void SocEstimator::reset(float soc, float deviation) {
+    socState = soc;
+    rcVoltage = 0;
+    p00 = deviation * deviation;
+    p01 = 0;
+    p11 = 0.01f;
+}
+
+void SocEstimator::update(float countedSoc, float current, float voltage, float dt) {
+    socState = countedSoc;
+    if (dt <= 0) {
+        return;
+    }
+
+    // Prediction. dt is small against tau, so exp(-dt/tau) ~ 1 - dt/tau.
+    float decay = max(1.0f - dt / TAU, 0.0f);
+    rcVoltage = decay * rcVoltage + (1.0f - decay) * R1 * current;
+    p00 += SOC_NOISE * dt;
+    p01 *= decay;
+    p11 = decay * decay * p11 + RC_NOISE * dt;
+
+    // Correction with the terminal voltage, H = [dOCV/dSOC, 1]
+    if (voltage > 0) {
+        float h = ocvSlope(socState);
+        float innovation = voltage - (ocvVoltage(socState) + rcVoltage + R0 * current);
+        float ph0 = h * p00 + p01; // (P H^T)[0]
+        float ph1 = h * p01 + p11; // (P H^T)[1]
+        float s = h * ph0 + ph1 + VOLTAGE_NOISE;
+        float k0 = ph0 / s;
+        float k1 = ph1 / s;
+        socState += k0 * innovation;
+        rcVoltage += k1 * innovation;
+        p00 = max(p00 - k0 * ph0, MIN_VARIANCE);
+        p01 -= k0 * ph1;
+        p11 = max(p11 - k1 * ph1, MIN_VARIANCE);
+    }
+    socState = constrain(socState, 0.0f, 1.0f);
+}
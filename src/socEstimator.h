@@ -0,0 +1,54 @@
+#pragma once
+
+// Extended Kalman filter for the SOC, enabled with -DSOC_EKF.
+//
+// The battery is an OCV source (ocvCurve.h) with a series resistance R0
+// and one RC branch (R1, tau) for the polarisation. The state is the SOC
+// and the voltage over the RC branch. The prediction is the SOC of the
+// coulomb counter, the correction compares the measured terminal voltage
+// with the model. The caller moves the counter by the correction, so the
+// charge itself is only integrated once, by the counter. Where the OCV
+// curve is flat (the middle of a LiFePO4 curve) the voltage says little
+// and the filter follows the counter; on the steep ends it pulls a
+// drifted count back.
+//
+// Two states, so everything is a handful of float operations without
+// matrices or loops. The model can be adjusted per env:
+//   -DSOC_EKF_R0_MOHM, -DSOC_EKF_R1_MOHM, -DSOC_EKF_TAU_S
+
+#include <Arduino.h>
+
+#ifndef SOC_EKF_R0_MOHM
+#define SOC_EKF_R0_MOHM 10
+#endif
+#ifndef SOC_EKF_R1_MOHM
+#define SOC_EKF_R1_MOHM 10
+#endif
+#ifndef SOC_EKF_TAU_S
+#define SOC_EKF_TAU_S 60
+#endif
+
+class SocEstimator {
+public:
+    SocEstimator();
+
+    // Starts over at soc with the given uncertainty (standard deviation)
+    void reset(float soc, float deviation);
+    // countedSoc: the SOC of the counter now. current (positive when
+    // charging) and voltage belong to the same sample, dt is the time
+    // since the last call in s. soc() is the corrected SOC afterwards.
+    void update(float countedSoc, float current, float voltage, float dt);
+
+    float soc() const { return socState; }
+    // Standard deviation of the SOC estimate
+    float deviation() const { return sqrtf(p00); }
+    float polarisation() const { return rcVoltage; }
+
+private:
+    float socState;
+    float rcVoltage;
+    // Covariance, symmetric
+    float p00;
+    float p01;
+    float p11;
+};
@@ -0,0 +1,229 @@
+#include "stateJournal.h"
+
+// "SHSJ"
+static const uint32_t SECTOR_MAGIC = 0x4A534853;
+static const uint32_t SECTOR_HEADER_SIZE = 8;
+static const uint32_t ERASED = 0xFFFFFFFF;
+
+// Record header word: CRC in the upper half, type and slot below
+enum { RECORD_FULL = 1, RECORD_DELTA = 2 };
+
+// CRC-16/CCITT over type, slot and the payload
+static uint16_t recordCrc(uint8_t type, uint8_t slot, const uint32_t* words, size_t count) {
+    uint16_t crc = 0xFFFF;
+    uint8_t head[2] = {type, slot};
+    const uint8_t* parts[2] = {head, (const uint8_t*)words};
+    size_t lengths[2] = {sizeof(head), count * 4};
+    for (uint8_t p = 0; p < 2; ++p) {
+        for (size_t i = 0; i < lengths[p]; ++i) {
+            crc ^= (uint16_t)parts[p][i] << 8;
+            for (uint8_t bit = 0; bit < 8; ++bit) {
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+            }
+        }
+    }
+    return crc;
+}
+
+static uint8_t countBits(uint32_t value) {
+    uint8_t count = 0;
+    for (; value; value &= value - 1) {
+        ++count;
+    }
+    return count;
+}
+
+StateJournal::StateJournal(FlashRegion& flash)
+    : flash(flash), numSectors(flash.size() / flash.sectorSize()), sector(0), offset(0), seq(0), numRecords(0),
+      numErases(0) {
+    memset(written, 0, sizeof(written));
+    memset(haveWritten, 0, sizeof(haveWritten));
+}
+
+bool StateJournal::begin() {
+    bool found = false;
+    uint32_t header[2];
+
+    memset(haveWritten, 0, sizeof(haveWritten));
+    for (uint32_t s = 0; s < numSectors; ++s) {
+        if (flash.read(s * flash.sectorSize(), header, sizeof(header)) && header[0] == SECTOR_MAGIC &&
+            (!found || (int32_t)(header[1] - seq) > 0)) {
+            found = true;
+            seq = header[1];
+            sector = s;
+        }
+    }
+    if (!found || numSectors < 2) {
+        // The first append starts at sector 0
+        sector = numSectors - 1;
+        offset = flash.sectorSize();
+        seq = 0;
+        return false;
+    }
+
+    uint32_t end;
+    bool clean = replaySector(sector, end) && isErased(sector * flash.sectorSize() + end, flash.sectorSize() - end);
+    // Nothing can be appended behind a broken record
+    offset = clean ? end : flash.sectorSize();
+    return true;
+}
+
+// A record that was cut short has no header, but its payload still
+// clears bits that a new record there would need.
+bool StateJournal::isErased(uint32_t address, uint32_t size) {
+    uint32_t words[16];
+    while (size > 0) {
+        uint32_t chunk = min(size, (uint32_t)sizeof(words));
+        if (!flash.read(address, words, chunk)) {
+            return false;
+        }
+        for (uint8_t i = 0; i < chunk / 4; ++i) {
+            if (words[i] != ERASED) {
+                return false;
+            }
+        }
+        address += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Applies the records of a sector. Returns false if it ends in a broken
+// record instead of erased flash, end is where the valid records end.
+bool StateJournal::replaySector(uint32_t s, uint32_t& end) {
+    uint32_t base = s * flash.sectorSize();
+    uint32_t pos = SECTOR_HEADER_SIZE;
+    uint32_t words[STAT_WORDS];
+
+    end = pos;
+    while (pos + 4 <= flash.sectorSize()) {
+        uint32_t header;
+        if (!flash.read(base + pos, &header, 4)) {
+            return false;
+        }
+        if (header == ERASED) {
+            return true;
+        }
+        uint8_t type = (header >> 8) & 0xFF;
+        uint8_t slot = header & 0xFF;
+        size_t count = STAT_WORDS;
+        if (type == RECORD_DELTA) {
+            if (pos + 8 > flash.sectorSize() || !flash.read(base + pos + 4, words, 4)) {
+                return false;
+            }
+            count = 1 + countBits(words[0]);
+        } else if (type != RECORD_FULL) {
+            return false;
+        }
+        if (slot >= NUM_SENSORS || count > STAT_WORDS || pos + 4 + count * 4 > flash.sectorSize() ||
+            !flash.read(base + pos + 4, words, count * 4) || recordCrc(type, slot, words, count) != header >> 16) {
+            return false;
+        }
+
+        if (type == RECORD_FULL) {
+            memcpy(written[slot], words, sizeof(written[slot]));
+            haveWritten[slot] = true;
+        } else if (haveWritten[slot]) {
+            const uint32_t* value = words + 1;
+            for (uint8_t i = 0; i < STAT_WORDS; ++i) {
+                if (words[0] & (1UL << i)) {
+                    written[slot][i] = *value++;
+                }
+            }
+        }
+        pos += 4 + count * 4;
+        end = pos;
+    }
+    return true;
+}
+
+bool StateJournal::restore(uint8_t slot, Statistics& stats) const {
+    if (slot >= NUM_SENSORS || !haveWritten[slot] || written[slot][0] != MAGICKEY) {
+        return false;
+    }
+    memcpy((void*)&stats, written[slot], sizeof(Statistics));
+    return true;
+}
+
+bool StateJournal::append(uint8_t slot, const Statistics& stats) {
+    uint32_t words[STAT_WORDS] = {0};
+    uint32_t payload[STAT_WORDS];
+    uint8_t type = RECORD_FULL;
+    size_t count = 0;
+
+    if (slot >= NUM_SENSORS || numSectors < 2) {
+        return false;
+    }
+    memcpy(words, &stats, sizeof(Statistics));
+    if (haveWritten[slot]) {
+        if (!memcmp(words, written[slot], sizeof(words))) {
+            return true;
+        }
+        uint32_t mask = 0;
+        count = 1;
+        for (uint8_t i = 0; i < STAT_WORDS; ++i) {
+            if (words[i] != written[slot][i]) {
+                mask |= 1UL << i;
+                payload[count++] = words[i];
+            }
+        }
+        payload[0] = mask;
+        type = RECORD_DELTA;
+    }
+    if (count == 0 || count >= STAT_WORDS) {
+        memcpy(payload, words, sizeof(words));
+        count = STAT_WORDS;
+        type = RECORD_FULL;
+    }
+
+    memcpy(written[slot], words, sizeof(words));
+    haveWritten[slot] = true;
+    if (offset + 4 + count * 4 > flash.sectorSize()) {
+        // The new sector starts with full records, this one included
+        return startSector();
+    }
+    return writeRecord(type, slot, payload, count);
+}
+
+// The header is written last, after the full records. Until the magic is
+// there the sector doesn't count, so a power loss in between leaves the
+// previous sector as the newest one.
+bool StateJournal::startSector() {
+    sector = (sector + 1) % numSectors;
+    // Should anything fail, the next append starts over with a new sector
+    offset = flash.sectorSize();
+    if (!flash.eraseSector(sector)) {
+        return false;
+    }
+    ++numErases;
+    offset = SECTOR_HEADER_SIZE;
+    for (uint8_t slot = 0; slot < NUM_SENSORS; ++slot) {
+        if (haveWritten[slot] && !writeRecord(RECORD_FULL, slot, written[slot], STAT_WORDS)) {
+            offset = flash.sectorSize();
+            return false;
+        }
+    }
+    uint32_t newSeq = seq + 1;
+    uint32_t magic = SECTOR_MAGIC;
+    uint32_t base = sector * flash.sectorSize();
+    if (!flash.write(base + 4, &newSeq, 4) || !flash.write(base, &magic, 4)) {
+        offset = flash.sectorSize();
+        return false;
+    }
+    seq = newSeq;
+    return true;
+}
+
+// The payload goes first. The header makes the record valid, so a power
+// loss before it was written leaves no record that looks complete.
+bool StateJournal::writeRecord(uint8_t type, uint8_t slot, const uint32_t* words, size_t count) {
+    uint32_t address = sector * flash.sectorSize() + offset;
+    uint32_t header = ((uint32_t)recordCrc(type, slot, words, count) << 16) | (type << 8) | slot;
+    if (!flash.write(address + 4, words, count * 4) || !flash.write(address, &header, 4)) {
+        offset = flash.sectorSize();
+        return false;
+    }
+    offset += (1 + count) * 4;
+    ++numRecords;
+    return true;
+}
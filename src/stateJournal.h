@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "common.h"
+#include "flashRegion.h"
+#include "statusHandling.h"
+
+// Append only journal of the battery Statistics in raw flash, so the state
+// survives a power loss and not only a reset like the RTC copy.
+//
+// The region is used as a ring of sectors. Every sector starts with a
+// header carrying a sequence number, followed by records. A record is a
+// full copy of one battery's Statistics or, usually, the 4 byte words that
+// changed since the previous record of that battery. Each sector starts
+// with full records of all batteries, so it can be restored on its own and
+// the oldest sector can be erased any time. Walking the ring spreads the
+// erases evenly over the region. Records carry a CRC and their header is
+// written last, one that was cut short by a power loss is ignored.
+class StateJournal {
+public:
+    StateJournal(FlashRegion& flash);
+
+    // Finds the newest sector and replays it. False if the region holds no
+    // journal yet.
+    bool begin();
+    // The newest state of that battery, false if there is none
+    bool restore(uint8_t slot, Statistics& stats) const;
+    // Writes a record if stats changed since the last one
+    bool append(uint8_t slot, const Statistics& stats);
+
+    uint32_t recordsWritten() const { return numRecords; }
+    uint32_t sectorsErased() const { return numErases; }
+
+private:
+    static const uint8_t STAT_WORDS = (sizeof(Statistics) + 3) / 4;
+    static_assert(STAT_WORDS <= 32, "The delta mask has 32 bits");
+
+    bool replaySector(uint32_t sector, uint32_t& end);
+    bool isErased(uint32_t address, uint32_t size);
+    bool startSector();
+    bool writeRecord(uint8_t type, uint8_t slot, const uint32_t* words, size_t count);
+
+    FlashRegion& flash;
+    uint32_t numSectors;
+    uint32_t sector;
+    uint32_t offset;
+    uint32_t seq;
+    uint32_t numRecords;
+    uint32_t numErases;
+    // What the journal holds for each battery, the base of the next delta
+    uint32_t written[NUM_SENSORS][STAT_WORDS];
+    bool haveWritten[NUM_SENSORS];
+};
@@ -1,38 +1,269 @@
 #include "common.h"
 #include "statusHandling.h"
+#include "timeHandling.h"
+#include "stateJournal.h"
+#include "ocvCurve.h"
+
+#ifndef JOURNAL_INTERVAL_S
+// One record per battery and interval at most. A record has about 34
+// bytes, so a 4k sector lasts about two hours.
+#define JOURNAL_INTERVAL_S 60
+#endif
+
+// A charge cycle is counted when the SOC drops below CYCLE_LOW_SOC and
+// then rises above CYCLE_HIGH_SOC again (as the BMV does it). A full
+// discharge when the battery reaches the minimum SOC, the next one only
+// after it was charged above CYCLE_LOW_SOC.
+static const float CYCLE_LOW_SOC = 0.65f;
+static const float CYCLE_HIGH_SOC = 0.90f;
+enum {
+    CYCLE_DISCHARGED = 0x01, // Below CYCLE_LOW_SOC since the last cycle
+    CYCLE_EMPTY = 0x02,      // Full discharge counted, not recharged yet
+    CYCLE_DISCHARGING = 0x04 // The running discharge got deeper since it started
+};
+// Shallower discharges, e.g. while floating at full, don't count
+static const float MIN_DISCHARGE = 0.01f;
+// An alarm clears once the voltage is back by this fraction of its threshold
+static const float ALARM_HYSTERESIS = 0.01f;
+// After a rest the voltage is known to about 10mV per cell (hysteresis,
+// temperature). Where the curve is flatter than 2mV per % that is more than
+// 5% SOC, there the counter stays. A voltage further than OCV_MARGIN off
+// the curve means it doesn't fit the battery.
+static const float MIN_OCV_SLOPE = 0.2f * BATTERY_CELLS;
+static const float OCV_MARGIN = 0.05f * BATTERY_CELLS;
+
+#ifdef SOC_EKF
+// SOC uncertainty after a boot and after a sync to a known SOC
+static const float START_DEVIATION = 0.05f;
+static const float SYNC_DEVIATION = 0.01f;
+#endif
 
 
 
 
-BatteryStatus gBattery;
+// One per sensor, each keeps its statistics in its own RTC slot
+BatteryStatus gBatteries[NUM_SENSORS] = {
+    BatteryStatus(0),
+#if NUM_SENSORS > 1
+    BatteryStatus(1),
+#endif
+#if NUM_SENSORS > 2
+    BatteryStatus(2),
+#endif
+#if NUM_SENSORS > 3
+    BatteryStatus(3),
+#endif
+};
+BatteryStatus& gBattery = gBatteries[0];
+
+#ifdef BATTERY_FIXED_POINT
+static const int64_t UAS_PER_AS = 1000000;
+static const int64_t PAS_PER_UAS = 1000000;
+static const int64_t UAS_PER_MAH = 3600000;
+// 0.01 kWh = 36000 Ws
+static const int64_t NWS_PER_10WH = 36000000000000LL;
+#endif
 
 
-BatteryStatus::BatteryStatus() {
+BatteryStatus::BatteryStatus(uint8_t rtcSlot) : rtcSlot(rtcSlot) {
     lastCurrent = 0;
     fullReachedAt = 0;
     lastSoc = 0;
-    glidingAverageCurrent = 0;
     lasStatUpdate = 0;
     isSynced = false;
-    if (!readStatusFromRTC()) {
+    lowAlarmVoltage = highAlarmVoltage = 0;
+    lowAlarm = highAlarm = false;
+    restCurrent = 0;
+    restTime = 0;
+    restSince = 0;
+    resting = restSynced = false;
+    numRestSyncs = 0;
+    nominalCapacity = batteryCapacity = 0;
+    nominalEfficiency = chargeEfficiency = 1;
+    minPercent = 0;
+    minAs = 0;
+    peukertExponent = 1;
+    temperatureCoefficient = 0;
+    profileMinute = 0;
+    useProfile = false;
+    profileTtg = NAN;
+    profileTtgMs = 0;
+    useLearned = false;
+#ifdef SOC_EKF
+    estimatorStarted = false;
+#endif
+    rtcRestored = readStatusFromRTC();
+    if (!rtcRestored) {
         stats.init();
     }
+#ifdef BATTERY_FIXED_POINT
+    lastCurrentuA = 0;
+    lastVoltagemV = 0;
+    capacityuAs = 0;
+    efficiencyQ16 = 1 << 16;
+    learnInuAs = learnOutuAs = 0;
+    loadAccumulators();
+#else
+    learnInAs = learnOutAs = 0;
+#endif
+}
+
+#ifdef BATTERY_FIXED_POINT
+void BatteryStatus::loadAccumulators() {
+    remainuAs = (int64_t)(stats.remainAs * UAS_PER_AS);
+    consumeduAs = (int64_t)(stats.consumedAs * UAS_PER_AS);
+    efficiencyRest = 0;
+    chargePAs = FixedCounter();
+    drawnmAh.set(stats.sumApHDrawn, UAS_PER_MAH);
+    dischargedEnergy.set(stats.amountDischargedEnergy, NWS_PER_10WH);
+    chargedEnergy.set(stats.amountChargedEnergy, NWS_PER_10WH);
+}
+
+// The float values in stats are what everybody else reads. They are
+// refreshed from the accumulators once per update cycle.
+void BatteryStatus::syncStats() {
+    stats.remainAs = (float)remainuAs / UAS_PER_AS;
+    stats.consumedAs = (float)consumeduAs / UAS_PER_AS;
+    stats.sumApHDrawn = drawnmAh.get(UAS_PER_MAH);
+    stats.amountDischargedEnergy = dischargedEnergy.get(NWS_PER_10WH);
+    stats.amountChargedEnergy = chargedEnergy.get(NWS_PER_10WH);
+}
+#endif
+
+void BatteryStatus::restoreStatistics(const Statistics& saved) {
+    memcpy((void*)&stats, &saved, sizeof(stats));
+    lastSoc = stats.socVal;
+#ifdef BATTERY_FIXED_POINT
+    loadAccumulators();
+#endif
+#ifdef SOC_EKF
+    estimatorStarted = false;
+#endif
+    applyCapacity();
+    writeStatusToRTC();
+}
+
+void BatteryStatus::setRemainAs(float value) {
+    stats.remainAs = value;
+#ifdef BATTERY_FIXED_POINT
+    remainuAs = (int64_t)(value * UAS_PER_AS);
+#endif
+}
+
+void BatteryStatus::correctRemainAs(float deltaAs) {
+#ifdef BATTERY_FIXED_POINT
+    remainuAs = constrain(remainuAs + (int64_t)llroundf(deltaAs * UAS_PER_AS), (int64_t)0, capacityuAs);
+    stats.remainAs = (float)remainuAs / UAS_PER_AS;
+#else
+    stats.remainAs = constrain(stats.remainAs + deltaAs, 0.0f, batteryCapacity);
+#endif
+}
+
+void BatteryStatus::resetConsumedAs() {
+    stats.consumedAs = 0.0;
+#ifdef BATTERY_FIXED_POINT
+    consumeduAs = 0;
+#endif
 }
 
 void BatteryStatus::setParameters(uint16_t capacityAh, uint16_t chargeEfficiencyPercent, uint16_t minPercent, uint16_t tailCurrentmA, uint16_t fullVoltagemV,uint16_t fullDelayS) 
 {
 
-        batteryCapacity = ((float)capacityAh) *60.0f * 60.0f; // We use it in As
-        chargeEfficiency = ((float)chargeEfficiencyPercent) / 100.0f;
+        nominalCapacity = ((float)capacityAh) *60.0f * 60.0f; // We use it in As
+        nominalEfficiency = ((float)chargeEfficiencyPercent) / 100.0f;
+        this->minPercent = minPercent;
         tailCurrent = tailCurrentmA / 1000.0f;
         fullVoltage = fullVoltagemV / 1000.0f;
-        minAs = minPercent * batteryCapacity / 100.0f;
         fullDelay = ((unsigned long)fullDelayS) *1000;    
+        applyCapacity();
+
         //SERIAL_DBG.printf("Init values: Capacity %.3f, efficiency %.3f, fullDelay %ld, \n",batteryCapacity,chargeEfficiency,fullDelay);
 
 }
 
+void BatteryStatus::setLearning(bool apply) {
+    useLearned = apply;
+    applyCapacity();
+}
+
+void BatteryStatus::applyCapacity() {
+    batteryCapacity = nominalCapacity;
+    chargeEfficiency = nominalEfficiency;
+    if (useLearned && stats.learner.capacityAs() > 0) {
+        batteryCapacity = stats.learner.capacityAs();
+    }
+    if (useLearned && stats.learner.efficiency() > 0) {
+        chargeEfficiency = stats.learner.efficiency();
+    }
+    minAs = minPercent * batteryCapacity / 100.0f;
+    ttgModel.configure(batteryCapacity, peukertExponent);
+#ifdef BATTERY_FIXED_POINT
+    capacityuAs = (int64_t)((double)batteryCapacity * UAS_PER_AS);
+    efficiencyQ16 = (uint32_t)(chargeEfficiency * 65536.0f);
+#endif
+}
+
+void BatteryStatus::setTtgModel(uint16_t peukert, uint16_t coefficient) {
+    peukertExponent = peukert / 100.0f;
+    temperatureCoefficient = coefficient / 1000.0f;
+    ttgModel.configure(batteryCapacity, peukertExponent);
+    ttgModel.setTemperature(ttgModel.temperature(), temperatureCoefficient);
+}
+
+void BatteryStatus::setTemperature(float celsius) {
+    float last = ttgModel.temperature();
+    // Only a change needs the factor again
+    if (isnan(celsius) != isnan(last) || fabsf(celsius - last) >= 0.1f) {
+        ttgModel.setTemperature(celsius, temperatureCoefficient);
+    }
+}
+
+void BatteryStatus::flushLearnCharge() {
+#ifdef BATTERY_FIXED_POINT
+    uint32_t inmAh = learnInuAs / UAS_PER_MAH;
+    uint32_t outmAh = learnOutuAs / UAS_PER_MAH;
+    learnInuAs -= inmAh * UAS_PER_MAH;
+    learnOutuAs -= outmAh * UAS_PER_MAH;
+#else
+    uint32_t inmAh = learnInAs / 3.6f;
+    uint32_t outmAh = learnOutAs / 3.6f;
+    learnInAs -= inmAh * 3.6f;
+    learnOutAs -= outmAh * 3.6f;
+#endif
+    stats.learner.addCharge(inmAh, outmAh);
+}
+
+void BatteryStatus::learnAt(float soc) {
+    flushLearnCharge();
+    if (stats.learner.syncPoint(soc, nominalCapacity, nominalEfficiency) && useLearned) {
+        applyCapacity();
+    }
+}
+
+#ifdef SOC_EKF
+// Runs with the once per second update, not per sample. The counter
+// integrates every sample; the filter only needs the charge in between.
+void BatteryStatus::updateEstimator() {
+    uint64_t now = uptimeMillis();
+    float counted = stats.remainAs / batteryCapacity;
+    if (!estimatorStarted) {
+        estimator.reset(counted, START_DEVIATION);
+        estimatorStarted = true;
+    } else {
+        estimator.update(counted, lastCurrent, lastVoltage, (now - estimatorMs) / 1000.0f);
+        correctRemainAs((estimator.soc() - counted) * batteryCapacity);
+    }
+    estimatorMs = now;
+}
+#endif
+
 void BatteryStatus::updateSOC() {
+#ifdef BATTERY_FIXED_POINT
+    syncStats();
+#endif
+#ifdef SOC_EKF
+    updateEstimator();
+#endif
     stats.socVal = stats.remainAs / batteryCapacity;
     if (fabs(lastSoc - stats.socVal) >= .005) {
         // Store value in RTC memory
@@ -41,47 +272,86 @@ void BatteryStatus::updateSOC() {
     }
 }
 
-void BatteryStatus::updateTtG() {
-    float avgCurrent = getAverageConsumption();
-    if (avgCurrent > 0.0) {
-        stats.tTgVal = max(stats.remainAs - minAs, 0.0f) / avgCurrent;
+void BatteryStatus::updateTtG(CurrentStatistics::Horizon horizon) {
+    float avgCurrent = getAverageConsumption(horizon);
+    if (useProfile && profile.ready() && profileMinute) {
+        uint64_t now = uptimeMillis();
+        // The prediction walks the profile, once per minute is enough
+        if (isnan(profileTtg) || now - profileTtgMs >= 60000) {
+            float factor = ttgModel.factor(max(avgCurrent, 0.0f));
+            profileTtg = profile.timeToGo(profileMinute, max(stats.remainAs - minAs, 0.0f) * factor,
+                                          (batteryCapacity - minAs) * factor, chargeEfficiency);
+            profileTtgMs = now;
+        }
+        stats.tTgVal = max(profileTtg - (now - profileTtgMs) / 1000.0f, 0.0f);
+    } else if (avgCurrent > 0.0) {
+        stats.tTgVal = max(stats.remainAs - minAs, 0.0f) * ttgModel.factor(avgCurrent) / avgCurrent;
     }  else {
         stats.tTgVal = INFINITY;
     }
 }
 
+void BatteryStatus::setTtgProfile(bool use) {
+    useProfile = use;
+    profileTtg = NAN;
+}
+
 void BatteryStatus::updateConsumption(float current, float period,
                                       uint16_t numPeriods) {
 
+    // A gap of several periods is a single longer entry
+    currentStats.add(current, period * numPeriods);
+
     // We use the average between the last and the current value for summation.
-    float periodConsumption;
 
-    for (int i = 0; i < numPeriods; ++i) {
-        if (currentValues.isFull()) {
-          float oldVal;
-          currentValues.pop(oldVal);
-          glidingAverageCurrent += oldVal;
-        }
-        currentValues.push(current);
-        // Assumtion: Consumption is negative
-        glidingAverageCurrent -= current;
-    }     
+#ifdef BATTERY_FIXED_POINT
+    int32_t currentuA = lroundf(current * 1000000.0f);
+    int32_t periodUs = lroundf(period * numPeriods * 1000000.0f);
+
+    // uA * us = pAs, the part below 1 uAs is carried over
+    chargePAs.add(((int64_t)lastCurrentuA + currentuA) * periodUs / 2, PAS_PER_UAS);
+    int64_t chargeuAs = chargePAs.value;
+    chargePAs.value = 0;
 
-    if(currentValues.isEmpty()) {
-        // This is the first measurement, so we don't have an old current value
-        lastCurrent = current;
+    // uAs * mV = nWs
+    int64_t energy = chargeuAs * lastVoltagemV;
+    if (chargeuAs > 0) {
+        // We are charging
+        chargedEnergy.add(energy, NWS_PER_10WH);
+        learnInuAs += chargeuAs;
+        efficiencyRest += chargeuAs * efficiencyQ16;
+        chargeuAs = efficiencyRest >> 16;
+        efficiencyRest -= chargeuAs << 16;
+    } else {
+        drawnmAh.add(-chargeuAs, UAS_PER_MAH);
+        learnOutuAs -= chargeuAs;
+        dischargedEnergy.add(-energy, NWS_PER_10WH);
     }
-    
-    periodConsumption = (lastCurrent + current) / 2.0 * period * numPeriods;
+
+    remainuAs += chargeuAs;
+    consumeduAs += chargeuAs;
+
+    if (remainuAs > capacityuAs) {
+        remainuAs = capacityuAs;
+    } else if (remainuAs < 0) {
+        remainuAs = 0;
+    }
+
+    lastCurrentuA = currentuA;
+    lastCurrent = current;
+#else
+    float periodConsumption = (lastCurrent + current) / 2.0 * period * numPeriods;
 
     // Has to be in 0.01 kWh....
     float consumption = periodConsumption / 3.6 / 1000.0 / 10.0 * lastVoltage;
     if (periodConsumption > 0) {
         // We are charging
         stats.amountChargedEnergy += consumption;
+        learnInAs += periodConsumption;
         periodConsumption *= chargeEfficiency;
     } else {
         stats.sumApHDrawn += periodConsumption / -3.6;
+        learnOutAs -= periodConsumption;
         stats.amountDischargedEnergy -= consumption;
     }
 
@@ -96,18 +366,18 @@ void BatteryStatus::updateConsumption(float current, float period,
     }
     
     lastCurrent = current;
+#endif
 }
 
-float BatteryStatus::getAverageConsumption() {
-    uint16_t count = currentValues.size();
-    if (count != 0) {
-        return  glidingAverageCurrent / count;
-    } else {
-        return 0;
-    }
+float BatteryStatus::getAverageConsumption(CurrentStatistics::Horizon horizon) {
+    // Assumtion: Consumption is negative
+    return -currentStats.average(horizon);
 }
 void BatteryStatus::setVoltage(float currVoltage) {
     lastVoltage = currVoltage;
+#ifdef BATTERY_FIXED_POINT
+    lastVoltagemV = lroundf(currVoltage * 1000.0f);
+#endif
 }
 
 bool BatteryStatus::checkFull() {
@@ -119,13 +389,14 @@ bool BatteryStatus::checkFull() {
         }
         float current = -1 * getAverageConsumption();
         if (current > 0.0 && current <= tailCurrent) {
-            unsigned long now = millis();
+            uint64_t now = uptimeMillis();
             if (fullReachedAt == 0) {
                 fullReachedAt = now;
             }
-            unsigned long delay = now - fullReachedAt;
+            uint64_t delay = now - fullReachedAt;
             if (delay >= fullDelay) {
                 // And here we are. 100 %
+                learnAt(1.0);
                 setBatterySoc(1.0);
                 if (!isSynced) {
                     resetStats();
@@ -133,8 +404,9 @@ bool BatteryStatus::checkFull() {
                 }
                 stats.secsSinceLastFull = 0;
                 stats.numAutoSyncs++;
-                stats.lastDischarge = roundf(stats.remainAs / 3.6);
-                stats.consumedAs = 0.0;
+                endDischarge();
+                resetConsumedAs();
+                stats.currentDischarge = 0;
                 return true;
             }
         } else {
@@ -149,9 +421,14 @@ bool BatteryStatus::checkFull() {
 
 void BatteryStatus::setBatterySoc(float val) {
     stats.socVal = val;
-    stats.remainAs = batteryCapacity * val;
+    setRemainAs(batteryCapacity * val);
+#ifdef SOC_EKF
+    estimator.reset(val, SYNC_DEVIATION);
+    estimatorMs = uptimeMillis();
+    estimatorStarted = true;
+#endif
     if(val>=1.0) {
-        fullReachedAt = millis();
+        fullReachedAt = uptimeMillis();
     }
     updateTtG();
 }
@@ -162,26 +439,126 @@ void BatteryStatus::resetStats() {
 }
 
 
-void BatteryStatus::updateStats(unsigned long now) {
-    int timeDeltaSec = (now - lasStatUpdate) / 1000;
-    lasStatUpdate = now;
-    if (timeDeltaSec < 0) {
-        // We had an overflow, so let's assume the last call was 1 sec ago (default interval)
-        timeDeltaSec = 1;
+void BatteryStatus::setAlarms(uint16_t lowVoltagemV, uint16_t highVoltagemV) {
+    lowAlarmVoltage = lowVoltagemV / 1000.0f;
+    highAlarmVoltage = highVoltagemV / 1000.0f;
+}
+
+void BatteryStatus::setRest(uint16_t restCurrentmA, uint16_t restTimeMin) {
+    restCurrent = restCurrentmA / 1000.0f;
+    restTime = restTimeMin * 60000UL;
+}
+
+bool BatteryStatus::checkRest() {
+    // Peaks within the last minute count as well
+    float peak = max(fabsf(currentStats.minimum(CurrentStatistics::HORIZON_1MIN)),
+                     fabsf(currentStats.maximum(CurrentStatistics::HORIZON_1MIN)));
+    uint64_t now = uptimeMillis();
+
+    if (restTime == 0 || currentStats.empty() || peak > restCurrent) {
+        resting = restSynced = false;
+        return false;
+    }
+    if (!resting) {
+        resting = true;
+        restSince = now;
+    }
+    if (restSynced || now - restSince < restTime) {
+        return false;
+    }
+    restSynced = true;
+    if (lastVoltage < ocvVoltage(0) - OCV_MARGIN || lastVoltage > ocvVoltage(1) + OCV_MARGIN) {
+        return false;
+    }
+    float soc = ocvSoc(lastVoltage);
+    if (ocvSlope(soc) < MIN_OCV_SLOPE) {
+        return false;
+    }
+    learnAt(soc);
+    setBatterySoc(soc);
+    ++numRestSyncs;
+    return true;
+}
+
+void BatteryStatus::endDischarge() {
+    if ((stats.cycleFlags & CYCLE_DISCHARGING) && stats.currentDischarge < -batteryCapacity * MIN_DISCHARGE / 3.6f) {
+        stats.lastDischarge = stats.currentDischarge;
+        // Running mean, no list of past discharges needed. The part the
+        // division cuts off is carried, else the mean freezes after a few
+        // hundred discharges.
+        ++stats.numDischarges;
+        int delta = stats.currentDischarge - stats.averageDischarge + stats.dischargeRemainder;
+        int step = delta / (int)stats.numDischarges;
+        stats.averageDischarge += step;
+        stats.dischargeRemainder = delta - step * (int)stats.numDischarges;
+    }
+    // The next discharge starts here, the depth stays relative to full
+    stats.cycleFlags &= ~CYCLE_DISCHARGING;
+    stats.currentDischarge = min(lroundf(stats.consumedAs / 3.6f), 0L);
+}
+
+void BatteryStatus::updateCycles() {
+    int mAh = lroundf(stats.consumedAs / 3.6f);
+    if (mAh < stats.currentDischarge) {
+        stats.currentDischarge = mAh;
+        stats.cycleFlags |= CYCLE_DISCHARGING;
+        if (mAh < stats.deepestDischarge) {
+            stats.deepestDischarge = mAh;
+        }
     }
+
+    if (stats.socVal < CYCLE_LOW_SOC) {
+        stats.cycleFlags |= CYCLE_DISCHARGED;
+    } else if (stats.socVal >= CYCLE_HIGH_SOC && (stats.cycleFlags & CYCLE_DISCHARGED)) {
+        stats.cycleFlags &= ~CYCLE_DISCHARGED;
+        stats.numChargeCycles++;
+        endDischarge();
+    }
+
+    if (stats.remainAs <= minAs && !(stats.cycleFlags & CYCLE_EMPTY)) {
+        stats.cycleFlags |= CYCLE_EMPTY;
+        stats.numFullDischarge++;
+    } else if (stats.socVal >= CYCLE_LOW_SOC) {
+        stats.cycleFlags &= ~CYCLE_EMPTY;
+    }
+}
+
+// Counted when an alarm is raised, not while it lasts
+void BatteryStatus::updateAlarms() {
+    if (lowAlarmVoltage > 0 && !lowAlarm && lastVoltage < lowAlarmVoltage) {
+        lowAlarm = true;
+        stats.numLowVoltageAlarms++;
+    } else if (lowAlarm && (lowAlarmVoltage <= 0 || lastVoltage >= lowAlarmVoltage * (1 + ALARM_HYSTERESIS))) {
+        lowAlarm = false;
+    }
+    if (highAlarmVoltage > 0 && !highAlarm && lastVoltage > highAlarmVoltage) {
+        highAlarm = true;
+        stats.numHighVoltageAlarms++;
+    } else if (highAlarm && (highAlarmVoltage <= 0 || lastVoltage <= highAlarmVoltage * (1 - ALARM_HYSTERESIS))) {
+        highAlarm = false;
+    }
+}
+
+// Everything here is updated in place once per second, in constant time
+void BatteryStatus::updateStats(uint64_t nowMs) {
+    // Only full seconds are counted, the rest is carried over to the next call
+    int timeDeltaSec = (nowMs - lasStatUpdate) / 1000;
+    lasStatUpdate += (uint64_t)timeDeltaSec * 1000;
     if (stats.secsSinceLastFull >= 0) {
         stats.secsSinceLastFull += timeDeltaSec;
     }
 
+    updateCycles();
+    updateAlarms();
+    flushLearnCharge();
 
-    if (stats.tTgVal != INFINITY) {
-        float mAh = stats.consumedAs / 3.6;
-        if (stats.deepestDischarge > mAh) {
-            stats.deepestDischarge = roundf(mAh);
+    uint32_t minute = epochSeconds() / 60;
+    if (minute != profileMinute) {
+        // The 1 minute average is the minute that just ended
+        if (profileMinute && minute == profileMinute + 1) {
+            profile.addMinute(profileMinute, getAverageConsumption(CurrentStatistics::HORIZON_1MIN));
         }
-        
-        stats.lastDischarge = roundf(mAh);
-        stats.averageDischarge = stats.lastDischarge;
+        profileMinute = minute;
     }
 
     uint32_t voltageV = lastVoltage * 1000;
@@ -194,17 +571,81 @@ void BatteryStatus::updateStats(unsigned long now) {
 }
 
 
+static StateJournal* journal = 0;
+
+void statusJournalInit() {
+    FlashRegion* region = flashJournalRegion();
+    if (!region) {
+        return;
+    }
+    journal = new StateJournal(*region);
+    if (!journal->begin()) {
+        SERIAL_DBG.println("No state journal found");
+        return;
+    }
+    for (uint8_t i = 0; i < NUM_SENSORS; ++i) {
+        Statistics saved;
+        if (!gBatteries[i].restoredFromRtc() && journal->restore(i, saved)) {
+            gBatteries[i].restoreStatistics(saved);
+        }
+    }
+}
+
+void statusJournalLoop(uint64_t nowMs) {
+    static uint64_t lastWrite = 0;
+    if (!journal || nowMs - lastWrite < JOURNAL_INTERVAL_S * 1000ULL) {
+        return;
+    }
+    lastWrite = nowMs;
+    for (uint8_t i = 0; i < NUM_SENSORS; ++i) {
+        journal->append(i, gBatteries[i].statistics());
+    }
+}
+
+#ifdef BENCH_CONSUMPTION
+// Measures the per sample cost of the accumulator on the target
+void benchmarkConsumption() {
+    static const uint16_t NUM_SAMPLES = 10000;
+    // Too big for the stack of the loop task
+    static BatteryStatus battery;
+    battery.setParameters(400, 95, 10, 1000, 55200, 30);
+    battery.setBatterySoc(0.5);
+    battery.setVoltage(52.0f);
+
+    uint32_t start = ESP.getCycleCount();
+    for (uint16_t i = 0; i < NUM_SAMPLES; ++i) {
+        battery.updateConsumption((i & 0xFF) * 0.1f - 12.8f, 0.270848f, 1);
+    }
+    uint32_t cycles = ESP.getCycleCount() - start;
+#ifdef BATTERY_FIXED_POINT
+    SERIAL_DBG.printf("updateConsumption (fixed point): %u cycles/sample\n", cycles / NUM_SAMPLES);
+#else
+    SERIAL_DBG.printf("updateConsumption (float): %u cycles/sample\n", cycles / NUM_SAMPLES);
+#endif
+#ifdef SOC_EKF
+    static SocEstimator estimator;
+    estimator.reset(0.5f, 0.05f);
+    start = ESP.getCycleCount();
+    for (uint16_t i = 0; i < NUM_SAMPLES; ++i) {
+        estimator.update(estimator.soc() + 0.00001f, (i & 0xFF) * 0.1f - 12.8f, 52.0f + (i & 0xF) * 0.01f, 1.0f);
+    }
+    cycles = ESP.getCycleCount() - start;
+    SERIAL_DBG.printf("SOC EKF update: %u cycles\n", cycles / NUM_SAMPLES);
+#endif
+}
+#endif
+
 #ifdef ESP32
-RTC_DATA_ATTR Statistics rtcStats;
+RTC_DATA_ATTR Statistics rtcStats[NUM_SENSORS];
 
 void BatteryStatus::writeStatusToRTC() {
-    memcpy(&rtcStats, &stats, sizeof(stats));
+    memcpy(&rtcStats[rtcSlot], &stats, sizeof(stats));
 }
 
 bool BatteryStatus::readStatusFromRTC() {
     bool res = true;
-    if (rtcStats.magic == MAGICKEY) {
-         memcpy(&stats, &rtcStats, sizeof(stats));
+    if (rtcSlot < NUM_SENSORS && rtcStats[rtcSlot].magic == MAGICKEY) {
+         memcpy(&stats, &rtcStats[rtcSlot], sizeof(stats));
     } else {
         res = false;
     }
@@ -212,17 +653,20 @@ bool BatteryStatus::readStatusFromRTC() {
 }
 
 #else 
+// RTC user memory is addressed in 4 byte blocks
+static const uint32_t RTC_SLOT_BLOCKS = (sizeof(Statistics) + 3) / 4;
+
 void BatteryStatus::writeStatusToRTC() {
-    ESP.rtcUserMemoryWrite(0, (uint32_t*)&stats, sizeof(stats));
+    ESP.rtcUserMemoryWrite(rtcSlot * RTC_SLOT_BLOCKS, (uint32_t*)&stats, sizeof(stats));
 }
 
 bool BatteryStatus::readStatusFromRTC() {
     uint32_t magic = 0;
-    if (!ESP.rtcUserMemoryRead(0, &magic, sizeof(magic)) || magic != MAGICKEY) {
+    if (!ESP.rtcUserMemoryRead(rtcSlot * RTC_SLOT_BLOCKS, &magic, sizeof(magic)) || magic != MAGICKEY) {
         return false;
     }
 
-    if (!ESP.rtcUserMemoryRead(0, (uint32_t*)&stats.magic, sizeof(stats))) {
+    if (!ESP.rtcUserMemoryRead(rtcSlot * RTC_SLOT_BLOCKS, (uint32_t*)&stats.magic, sizeof(stats))) {
         Serial.println("RTC read failed!");
         return false;
     }
@@ -2,13 +2,22 @@
 #pragma once
 
 #include <Arduino.h>
-#include <RingBuf.h>
 
+#include "common.h"
+#include "currentStatistics.h"
+#include "capacityLearner.h"
+#include "ttgCompensation.h"
+#include "loadProfile.h"
+#ifdef SOC_EKF
+#include "socEstimator.h"
+#endif
 
-static const int MAGICKEY = 0x343332;
+
+static const int MAGICKEY = 0x343335;
 struct Statistics {
     void init() {
-        memset(this, 0, sizeof(*this));
+        // Everything but the magic, that marks a valid copy
+        memset((uint8_t*)this + sizeof(magic), 0, sizeof(*this) - sizeof(magic));
         secsSinceLastFull = -1;
         minBatVoltage = INT32_MAX;
     }
@@ -19,9 +28,10 @@ struct Statistics {
     float tTgVal;
     // Here the statistics start
     float consumedAs;
-    unsigned int deepestDischarge;
-    unsigned int lastDischarge;
-    unsigned int averageDischarge;
+    // Depths in mAh relative to full, i.e. negative like consumedAs
+    int deepestDischarge;
+    int lastDischarge;
+    int averageDischarge;
     unsigned int numChargeCycles;
     unsigned int numFullDischarge;
     float sumApHDrawn;
@@ -33,23 +43,75 @@ struct Statistics {
     unsigned int numHighVoltageAlarms;
     float amountDischargedEnergy;
     float amountChargedEnergy;
+    // State of the cycle counting in updateStats()
+    unsigned int numDischarges;
+    int dischargeRemainder; // mAh / numDischarges the mean is still off
+    int currentDischarge; // Deepest point of the running discharge in mAh
+    unsigned int cycleFlags;
+    // Capacity and efficiency learned between syncs
+    CapacityLearner learner;
 };
 
 
+#ifdef BATTERY_FIXED_POINT
+// Integer counter that never loses a fraction. Values are added in a fine
+// unit, whole units are moved to value, the rest stays in fraction.
+struct FixedCounter {
+    int64_t value;
+    int64_t fraction;
+
+    void add(int64_t fine, int64_t unit) {
+        fraction += fine;
+        if (fraction >= unit || fraction <= -unit) {
+            int64_t whole = fraction / unit;
+            value += whole;
+            fraction -= whole * unit;
+        }
+    }
+    void set(float val, int64_t unit) {
+        value = (int64_t)val;
+        fraction = (int64_t)((val - value) * unit);
+    }
+    float get(int64_t unit) const { return value + (float)fraction / unit; }
+};
+#endif
+
 class BatteryStatus {
-protected:
-    static const uint16_t GlidingAverageWindow = 60;
 public:
-    BatteryStatus();
+    // rtcSlot selects where the statistics survive a reset
+    BatteryStatus(uint8_t rtcSlot = 0);
     ~BatteryStatus() {}
 
     void setParameters(uint16_t capacityAh, uint16_t chargeEfficiencyPercent, uint16_t minPercent, uint16_t tailCurrentmA, uint16_t fullVoltagemV, uint16_t fullDelayS);
     void updateSOC();
-    void updateTtG();
+    // Time to go from the average current over this horizon, or from the
+    // daily load profile if selected and learned
+    void updateTtG(CurrentStatistics::Horizon horizon = CurrentStatistics::HORIZON_1MIN);
     void setVoltage(float currVoltage);
     bool checkFull();
     void updateConsumption(float current, float period, uint16_t numPeriods);
-    void updateStats(unsigned long now);
+    void updateStats(uint64_t nowMs);
+    // Voltage alarm thresholds in mV, 0 turns the alarm off
+    void setAlarms(uint16_t lowVoltagemV, uint16_t highVoltagemV);
+    // The battery rests while the current stays below restCurrentmA in both
+    // directions, after restTimeMin the SOC is taken from the open circuit
+    // voltage. 0 minutes turns it off.
+    void setRest(uint16_t restCurrentmA, uint16_t restTimeMin);
+    // True if the SOC was just synchronised to the open circuit voltage
+    bool checkRest();
+    // Use the learned capacity and efficiency instead of the configured
+    // ones, as soon as there are any
+    void setLearning(bool apply);
+    // Peukert exponent in 0.01 (100 = off), capacity loss in 0.1% per
+    // degree below 20 degrees
+    void setTtgModel(uint16_t peukertExponent, uint16_t temperatureCoefficient);
+    // Predict the time to go from the daily load profile
+    void setTtgProfile(bool use);
+    // Battery temperature in degrees, NAN if unknown
+    void setTemperature(float celsius);
+    float temperature() const {
+        return ttgModel.temperature();
+    }
 
     //Getters
     float tTg() {
@@ -61,6 +123,16 @@ public:
     bool isFull() {
         return (fullReachedAt != 0);
     }
+    bool lowVoltageAlarm() const {
+        return lowAlarm;
+    }
+    bool highVoltageAlarm() const {
+        return highAlarm;
+    }
+    // Synchronisations to the open circuit voltage since the start
+    uint32_t restSyncs() const {
+        return numRestSyncs;
+    }
 
     float voltage() {
         return lastVoltage;
@@ -71,32 +143,144 @@ public:
     float averageCurrent() {
         return getAverageConsumption();
     }
+    const CurrentStatistics& currentStatistics() const {
+        return currentStats;
+    }
+#ifdef SOC_EKF
+    const SocEstimator& socEstimator() const {
+        return estimator;
+    }
+#endif
+
+    // Learns once per minute while the clock is set, historyInit() seeds it
+    LoadProfile& loadProfile() {
+        return profile;
+    }
+    const CapacityLearner& capacityLearner() const {
+        return stats.learner;
+    }
+    // What SOC and time to go are based on, As and 0..1
+    float capacity() const {
+        return batteryCapacity;
+    }
+    float efficiency() const {
+        return chargeEfficiency;
+    }
 
     void setBatterySoc(float val);
     const Statistics& statistics() {return stats;}
+    // False if the RTC memory held nothing, e.g. after a power loss
+    bool restoredFromRtc() const {return rtcRestored;}
+    // Takes over statistics saved elsewhere, e.g. in the flash journal
+    void restoreStatistics(const Statistics& saved);
 
     protected:                
-        float getAverageConsumption();
+        // Average current drawn from the battery, positive when discharging
+        float getAverageConsumption(CurrentStatistics::Horizon horizon = CurrentStatistics::HORIZON_1MIN);
         // This is called when we become synced for the first time;
         void resetStats();
         void writeStatusToRTC();
         bool readStatusFromRTC();
-        RingBuf<float, GlidingAverageWindow> currentValues;
+        void setRemainAs(float value);
+        // Moves remainAs without losing the fraction the counter holds
+        void correctRemainAs(float deltaAs);
+        void resetConsumedAs();
+        // Closes the running discharge, e.g. when the battery is full again
+        void endDischarge();
+        void updateCycles();
+        void updateAlarms();
+        // Capacity, efficiency and what depends on them, configured or learned
+        void applyCapacity();
+        // Hands the charge counted so far to the learner
+        void flushLearnCharge();
+        // A sync to a known SOC, call before the SOC is set
+        void learnAt(float soc);
+#ifdef BATTERY_FIXED_POINT
+        void loadAccumulators();
+        void syncStats();
+#endif
+#ifdef SOC_EKF
+        // Corrects remainAs with the voltage
+        void updateEstimator();
+#endif
+        CurrentStatistics currentStats;
+        float nominalCapacity; // As configured
+        float nominalEfficiency;
+        uint16_t minPercent;
+        bool useLearned;
         float batteryCapacity;
+        float peukertExponent;
+        float temperatureCoefficient;
+        TtgCompensation ttgModel;
+        LoadProfile profile;
+        uint32_t profileMinute; // The minute being measured, 0 = none
+        bool useProfile;
+        float profileTtg; // Predicted at profileTtgMs, NAN = not yet
+        uint64_t profileTtgMs;
         float chargeEfficiency; // Value between 0 and 1 (representing percent)       
         float tailCurrent; // For full detection, A going ointo the battery
         float fullVoltage; // Voltage when Battery ois assumed to be full
         float minAs; // Amount of As that are in the battery when we assume it to be empty
         unsigned long fullDelay; // For how long do we need Full Voltage and current < tailCurrent to assume battery is full
+        float lowAlarmVoltage; // 0 = off
+        float highAlarmVoltage;
+        bool lowAlarm;
+        bool highAlarm;
+        float restCurrent;
+        unsigned long restTime; // 0 = off
+        uint64_t restSince;
+        bool resting;
+        bool restSynced; // Only once per rest period
+        uint32_t numRestSyncs;
+#ifndef BATTERY_FIXED_POINT
+        // Charge without efficiency that didn't make a full mAh for the
+        // learner yet
+        float learnInAs;
+        float learnOutAs;
+#endif
 
         float lastVoltage;
         float lastCurrent;        
-        unsigned long fullReachedAt;        
-        float glidingAverageCurrent;
+        uint64_t fullReachedAt;
         float lastSoc;
-        unsigned long lasStatUpdate;
+        uint64_t lasStatUpdate;
         bool isSynced;
+        uint8_t rtcSlot;
+        bool rtcRestored;
         Statistics stats;
+#ifdef SOC_EKF
+        SocEstimator estimator;
+        bool estimatorStarted;
+        uint64_t estimatorMs;
+#endif
+#ifdef BATTERY_FIXED_POINT
+        // Charge in micro As, energy in nano Ws. On a CPU without FPU this
+        // is faster than float and a 400Ah bank keeps uAs resolution.
+        int32_t lastCurrentuA;
+        int32_t lastVoltagemV;
+        int64_t capacityuAs;
+        int64_t remainuAs;
+        int64_t consumeduAs;
+        uint32_t efficiencyQ16; // Charge efficiency * 65536
+        int64_t efficiencyRest;
+        FixedCounter chargePAs; // pAs that did not make a full uAs yet
+        FixedCounter drawnmAh;
+        FixedCounter dischargedEnergy; // 0.01 kWh
+        FixedCounter chargedEnergy;
+        int64_t learnInuAs;
+        int64_t learnOutuAs;
+#endif
 };
 
-extern BatteryStatus gBattery;
+extern BatteryStatus gBatteries[NUM_SENSORS];
+// The first battery, the one VE.Direct and Modbus report
+extern BatteryStatus& gBattery;
+
+// Restores batteries the RTC memory didn't have from the flash journal
+void statusJournalInit();
+// Appends the statistics to the journal, at most every JOURNAL_INTERVAL_S
+void statusJournalLoop(uint64_t nowMs);
+
+#ifdef BENCH_CONSUMPTION
+void benchmarkConsumption();
+#endif
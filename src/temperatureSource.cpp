@@ -0,0 +1,15 @@
+#include "temperatureSource.h"
+
+static TemperatureSource* temperatureSource = 0;
+
+void temperatureSetSource(TemperatureSource* source) {
+    temperatureSource = source;
+}
+
+float temperatureRead() {
+    float celsius;
+    if (temperatureSource && temperatureSource->read(celsius)) {
+        return celsius;
+    }
+    return NAN;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Where the battery temperature comes from. Nothing is fitted by default;
+// a sensor driver derives from TemperatureSource and registers itself with
+// temperatureSetSource(). The native build has a mock (native/temperatureMock.h).
+
+#include <Arduino.h>
+
+class TemperatureSource {
+public:
+    virtual ~TemperatureSource() {}
+    // In degrees Celsius, false if there is no valid reading
+    virtual bool read(float& celsius) = 0;
+};
+
+// 0 removes the source
+void temperatureSetSource(TemperatureSource* source);
+// The battery temperature or NAN without a source or reading
+float temperatureRead();
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+// Monotonic time since boot. 64 bits of microseconds don't wrap in the
+// lifetime of the device, unlike millis() (49 days) and micros() (71 min).
+inline uint64_t uptimeMicros() {
+#ifdef ESP32
+    return esp_timer_get_time();
+#else
+    return micros64();
+#endif
+}
+
+inline uint64_t uptimeMillis() { return uptimeMicros() / 1000; }
+
+// Seconds since 1970 once SNTP has set the clock, 0 before
+inline uint32_t epochSeconds() {
+#ifdef NATIVE_BUILD
+    // The simulation starts on 2024-01-01 00:00 UTC with a set clock
+    return 1704067200UL + uptimeMillis() / 1000;
+#else
+    time_t now = time(nullptr);
+    return now > 1600000000 ? now : 0;
+#endif
+}
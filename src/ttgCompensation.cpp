@@ -0,0 +1,47 @@
+#include "ttgCompensation.h"
+
+// Capacities are rated at a 20h discharge and 20 degrees
+static const float RATED_HOURS = 20.0f;
+static const float RATED_CELSIUS = 20.0f;
+// A cold battery still delivers something
+static const float MIN_TEMPERATURE_FACTOR = 0.2f;
+
+TtgCompensation::TtgCompensation() : ratedCurrent(0), temperatureFactor(1), celsius(NAN) {
+    configure(0, 1);
+}
+
+void TtgCompensation::configure(float capacityAs, float exponent) {
+    ratedCurrent = capacityAs / 3600.0f / RATED_HOURS;
+    // r = m * 2^e, so r^(1 - k) = (2^(1 - k))^e * m^(1 - k)
+    for (uint8_t e = 0; e <= OCTAVES; ++e) {
+        octave[e] = powf(2.0f, e * (1.0f - exponent));
+    }
+    for (uint8_t i = 0; i <= MANTISSA_STEPS; ++i) {
+        mantissa[i] = powf(0.5f + 0.5f * i / MANTISSA_STEPS, 1.0f - exponent);
+    }
+}
+
+void TtgCompensation::setTemperature(float value, float coefficient) {
+    celsius = value;
+    temperatureFactor = 1;
+    if (!isnan(value) && value < RATED_CELSIUS) {
+        temperatureFactor = max(1.0f - coefficient * (RATED_CELSIUS - value), MIN_TEMPERATURE_FACTOR);
+    }
+}
+
+float TtgCompensation::factor(float current) const {
+    float ratio = ratedCurrent > 0 ? current / ratedCurrent : 0;
+    if (ratio <= 1.0f) {
+        return temperatureFactor;
+    }
+    int e;
+    float m = frexpf(ratio, &e);
+    if (e > OCTAVES) {
+        e = OCTAVES;
+        m = 1.0f;
+    }
+    float position = (m - 0.5f) * 2 * MANTISSA_STEPS;
+    uint8_t i = min((uint8_t)position, (uint8_t)(MANTISSA_STEPS - 1));
+    float scale = mantissa[i] + (mantissa[i + 1] - mantissa[i]) * (position - i);
+    return octave[e] * scale * temperatureFactor;
+}
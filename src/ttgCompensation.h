@@ -0,0 +1,40 @@
+#pragma once
+
+// Corrects the time to go for the discharge rate and the temperature.
+//
+// Peukert: at a current I above the rated one (capacity / 20h) only
+// (I / Irated)^(1 - k) of the remaining charge can be drawn. Below the
+// rated current nothing is gained. Temperature: the capacity drops by a
+// fixed fraction per degree below 20 degrees.
+//
+// Both factors are prepared when the parameters or the temperature change.
+// The Peukert factor is a table over the octaves of I / Irated and one over
+// the mantissa, so the per second lookup is frexpf(), two table reads and
+// an interpolation instead of powf().
+
+#include <Arduino.h>
+
+class TtgCompensation {
+public:
+    TtgCompensation();
+
+    // exponent 1 turns the Peukert correction off
+    void configure(float capacityAs, float exponent);
+    // coefficient: fraction of the capacity per degree, NAN = unknown
+    void setTemperature(float celsius, float coefficient);
+
+    // Part of the remaining charge that can be drawn at this discharge
+    // current in A
+    float factor(float current) const;
+    float temperature() const { return celsius; }
+
+private:
+    static const uint8_t OCTAVES = 10;
+    static const uint8_t MANTISSA_STEPS = 8;
+
+    float ratedCurrent;
+    float temperatureFactor;
+    float celsius;
+    float octave[OCTAVES + 1];
+    float mantissa[MANTISSA_STEPS + 1];
+};
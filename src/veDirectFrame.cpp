@@ -0,0 +1,53 @@
+#include "veDirectFrame.h"
+
+void VeDirectFrame::startField(const char* label) {
+    put('\r');
+    put('\n');
+    put(label);
+    put('\t');
+}
+
+void VeDirectFrame::add(const char* label, int32_t value) {
+    char digits[10];
+    uint8_t count = 0;
+    // Also right for INT32_MIN
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+
+    startField(label);
+    if (value < 0) {
+        put('-');
+    }
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    while (count) {
+        put(digits[--count]);
+    }
+}
+
+void VeDirectFrame::add(const char* label, const char* value) {
+    startField(label);
+    put(value);
+}
+
+void VeDirectFrame::addHex(const char* label, uint32_t value, const char* prefix) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    char digits[8];
+    uint8_t count = 0;
+
+    startField(label);
+    put(prefix);
+    do {
+        digits[count++] = HEX_DIGITS[value & 0xF];
+        value >>= 4;
+    } while (value);
+    while (count) {
+        put(digits[--count]);
+    }
+}
+
+void VeDirectFrame::end() {
+    startField("Checksum");
+    put((char)(0 - sum));
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// A VE.Direct text frame, built in a fixed buffer.
+//
+// Every field is "\r\n<label>\t<value>", the frame ends with the Checksum
+// field whose value byte makes all bytes of the frame sum up to 0. The sum
+// is kept while the fields are added, numbers are formatted by hand, so
+// building a frame neither touches the heap nor walks the bytes twice.
+
+#include <Arduino.h>
+
+class VeDirectFrame {
+public:
+    // More than any frame of the text protocol needs
+    static const size_t CAPACITY = 256;
+
+    VeDirectFrame() : length(0), sum(0), overflowed(false) {}
+
+    void begin() {
+        length = 0;
+        sum = 0;
+        overflowed = false;
+    }
+    void add(const char* label, int32_t value);
+    void add(const char* label, const char* value);
+    // Lower case hex without leading zeros, e.g. "0xa389" with prefix "0x"
+    void addHex(const char* label, uint32_t value, const char* prefix = "");
+    // Appends the checksum, the frame is complete then
+    void end();
+
+    const uint8_t* data() const { return buffer; }
+    size_t size() const { return length; }
+    // A field didn't fit, the frame is cut short
+    bool overflow() const { return overflowed; }
+
+private:
+    void startField(const char* label);
+    void put(char c) {
+        if (length < CAPACITY) {
+            buffer[length++] = c;
+            sum += c;
+        } else {
+            overflowed = true;
+        }
+    }
+    void put(const char* s) {
+        while (*s) {
+            put(*s++);
+        }
+    }
+
+    uint8_t buffer[CAPACITY];
+    size_t length;
+    uint8_t sum;
+    bool overflowed;
+};
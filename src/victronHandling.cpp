@@ -2,7 +2,12 @@
 #include <Arduino.h>
 
 #include "common.h"
+#include "hexParser.h"
+#include "hexRegisters.h"
+#include "sensorHandling.h"
 #include "statusHandling.h"
+#include "victronHandling.h"
+#include "webHandling.h"
 
 // This is a SmartShunt 500A
 static const uint16_t PID = 0xA389;
@@ -15,27 +20,17 @@ static const unsigned long UART_TIMEOUT = 900;
 
 
 static unsigned long lastHexCmdMillis = 0;
+// A host sent a HEX command, so it listens to async messages
+static bool hexHost = false;
 
-enum STATE {
-    IDLE = 0,
+enum COMMANDS {
     COMMAND_PING = 1,
     COMMAND_APP_VERSION = 3,
     COMMAND_PRODUCT_ID = 4,
     COMMAND_RESTART = 6,
     COMMAND_GET = 7,
     COMMAND_SET = 8,
-    COMMAND_ASYNC = 0xA,
-    COMMAND_UNKNOWN,
-    NUM_COMMANDS,
-    READ_COMMAND,
-    READ_CHECKSUM,
-    READ_REGISTER,
-    READ_FLAGS,
-    READ_VALUE,
-    READ_DATA,
-    READ_STRING,
-    COMPLETE,
-    EXECUTE
+    COMMAND_ASYNC = 0xA
 };
 
 enum ANSWERS {
@@ -46,127 +41,109 @@ enum ANSWERS {
     ANSWER_SET = 8
 };
 
-enum FLAGS {
-    FLAG_OK = 0x0,
-    FLAG_UNKNOWN_ID = 0x1,
-    FLAG_NOT_SUPPORTED = 0x2,
-    FLAG_PARAMETER_ERROR = 0x4
+// What goes out on the UART. Nothing is written before the FIFO has room
+// for it, so the loop never waits for the 19200 baud line.
+enum TX_STATE {
+    TX_IDLE,
+    TX_TEXT,
+    TX_HEX
 };
 
+enum TEXT_BLOCKS {
+    TEXT_SMALL = 1,
+    TEXT_HISTORY = 2
+};
+
+static TX_STATE txState = TX_IDLE;
+static uint16_t txPos = 0;
+// The text blocks that are due, see TEXT_BLOCKS
+static uint8_t textDue = 0;
+
+// ':', the command nibble, 2 digits per byte and the checksum, '\n'
+static const uint16_t HEX_ANSWER_MAX = 2 * (4 + HEX_MAX_VALUE) + 3;
+
+// Hex answers wait here for the text frame in flight
+static uint8_t hexBuffer[2 * HEX_ANSWER_MAX];
+static uint16_t hexSize = 0;
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
 void sendAnswer(uint8_t* bytes, uint8_t count) {
+    if (hexSize + 2 * count + 3 > (int)sizeof(hexBuffer)) {
+        return;
+    }
+    uint8_t* out = hexBuffer + hexSize;
     uint8_t checksum = bytes[0];
-    SERIAL_VICTRON.write(':');
+    *out++ = ':';
     // This is the command, just 1 nibble
-    SERIAL_VICTRON.printf("%hhX", bytes[0]);
+    *out++ = hexDigits[bytes[0] & 0xF];
     for (int i = 1; i < count; ++i) {
         checksum += bytes[i];
-        SERIAL_VICTRON.printf("%02hhX", bytes[i]);
+        *out++ = hexDigits[bytes[i] >> 4];
+        *out++ = hexDigits[bytes[i] & 0xF];
     }
     checksum = 0x55 - checksum;
-    SERIAL_VICTRON.printf("%02hhX", checksum);
-    SERIAL_VICTRON.write('\n');
+    *out++ = hexDigits[checksum >> 4];
+    *out++ = hexDigits[checksum & 0xF];
+    *out++ = '\n';
+    hexSize = out - hexBuffer;
 }
 
-typedef void (*CommandFunc)(uint8_t, uint16_t, uint8_t, uint8_t*, uint8_t);
+typedef void (*CommandFunc)(uint8_t, uint16_t, uint8_t, const uint8_t*, uint8_t);
 
-void commandPing(uint8_t command, uint16_t, uint8_t, uint8_t*, uint8_t) {
+void commandPing(uint8_t command, uint16_t, uint8_t, const uint8_t*, uint8_t) {
     uint8_t answer[] = { 5, AppId & 0xFF, AppId >> 8 };
     sendAnswer(answer, sizeof(answer));
 }
 
-void commandAppVersion(uint8_t command, uint16_t, uint8_t, uint8_t*, uint8_t) {
+void commandAppVersion(uint8_t command, uint16_t, uint8_t, const uint8_t*, uint8_t) {
     uint8_t answer[] = { 1, AppId & 0xFF, AppId >> 8 };
     sendAnswer(answer, sizeof(answer));
 }
 
-void commandProductId(uint8_t command, uint16_t, uint8_t, uint8_t*, uint8_t) {
+void commandProductId(uint8_t command, uint16_t, uint8_t, const uint8_t*, uint8_t) {
     uint8_t answer[] = { 1, PID & 0xFF, PID >> 8 };
     sendAnswer(answer, sizeof(answer));
 }
 
-void commandRestart(uint8_t command, uint16_t, uint8_t, uint8_t*, uint8_t) {
+void commandRestart(uint8_t command, uint16_t, uint8_t, const uint8_t*, uint8_t) {
     // Ignore for now
 }
 
-void commandGet(uint8_t command, uint16_t address, uint8_t flags, uint8_t*,
+void commandGet(uint8_t command, uint16_t address, uint8_t flags, const uint8_t*,
     uint8_t) {
-    uint8_t answer[128];
-    uint8_t aSize = 4;
-    size_t len;
-    char serialnr[32];
+    uint8_t answer[4 + HEX_MAX_VALUE];
+    uint8_t size;
     answer[0] = COMMAND_GET;
     answer[1] = (uint8_t)address;
     answer[2] = (uint8_t)(address >> 8);
-    answer[3] = FLAG_OK;
-    answer[4] = 0;
-    answer[5] = 0;
-
-    switch (address) {
-        case 0xEEB8:
-            aSize = 6;
-            break;
-        case 0x034F:
-            aSize = 5;
-            break;
-        case 0x010A:
-#if ESP32
-            sprintf(serialnr, "%08X", ESP.getEfuseMac());
-#else
-            sprintf(serialnr, "%08X", ESP.getChipId());
-#endif
-            
-            len = strlen(serialnr);
-            aSize = 4 + len;
-            memcpy(answer + 4, serialnr, len);
-            break;
-        case 0x010C:
-            len = strlen(gCustomName);
-            aSize = 4 + len;
-            memcpy(answer + 4, gCustomName, len);
-            break;
-        case 0x0104:
-            // GroupId. Used to group similar devices together...
-            // u8. We use 0, since I have no better idea
-            aSize = 5;
-            break;
-        default:
-            answer[3] = FLAG_UNKNOWN_ID;
-            // SERIAL_DBG.printf("Unknown GET address 0x%X\r\n",address);
-            break;
-    }
+    answer[3] = hexRegisterGet(address, answer + 4, size);
 
-    sendAnswer(answer, aSize);
+    sendAnswer(answer, 4 + size);
 }
 
 void commandSet(uint8_t command, uint16_t address, uint8_t flags,
-    uint8_t* valueBuf, uint8_t valueSize) {
-    uint8_t answer[128];
+    const uint8_t* valueBuf, uint8_t valueSize) {
+    uint8_t answer[4 + HEX_MAX_VALUE];
+    uint8_t size = min(valueSize, HEX_MAX_VALUE);
 
     answer[0] = COMMAND_SET;
     answer[1] = (uint8_t)address;
     answer[2] = (uint8_t)(address >> 8);
-    answer[3] = FLAG_OK;
-    memcpy(answer + 4, valueBuf, valueSize);
-
-    switch (address) {
-        case 0x010C:
-            //Value should be astring
-            // This can be set
-            memcpy(gCustomName, valueBuf, valueSize);
-            gCustomName[valueSize] = 0;
-            break;
-        default:
-            answer[3] = FLAG_UNKNOWN_ID;
-            break;
+    answer[3] = hexRegisterSet(address, valueBuf, valueSize);
+    if (answer[3] == FLAG_OK) {
+        // The value as it is now
+        hexRegisterGet(address, answer + 4, size);
+    } else {
+        memcpy(answer + 4, valueBuf, size);
     }
 
-    sendAnswer(answer, valueSize + 4); 
+    sendAnswer(answer, 4 + size);
 }
 
-void commandUnknown(uint8_t command, uint16_t, uint8_t, uint8_t*, uint8_t) {
+void commandUnknown(uint8_t command, uint16_t, uint8_t, const uint8_t*, uint8_t) {
     uint8_t answer[2] = { ANSWER_UNKNOWN, command };
 
-     SERIAL_DBG.printf("Unknown command: %d\r\n",command);
     // Unknown command received
     sendAnswer(answer, sizeof(answer));
 }
@@ -176,6 +153,8 @@ CommandFunc commandHandlers[] = {
     commandProductId, commandUnknown, commandRestart, commandGet,
     commandSet, commandUnknown, commandUnknown };
 
+static const uint8_t NUM_HANDLERS = sizeof(commandHandlers) / sizeof(commandHandlers[0]);
+
 void victronInit() {
     if (gVictronEanbled) {
         if (SERIAL_VICTRON.baudRate() != 19200) {
@@ -184,257 +163,215 @@ void victronInit() {
     }
 }
 
-uint8_t calcChecksum(const String& s) {
-    int len = s.length();
-    uint8_t result = 0;
-    for (int i = 0; i < len; ++i) {
-        result += s[i];
-    }
-    return 256u - result;
-}
+static VeDirectFrame frame;
 
-void sendSmallBlock() {
+const VeDirectFrame& victronSmallBlock() {
     int intVal;
     const Statistics& stats = gBattery.statistics();
-    
-    String S = "\r\nPID\t0x" + String(PID, 16);
-    intVal = roundf(gBattery.voltage() * 1000);
-    S += "\r\nV\t" + String(intVal, 10);
-    intVal = roundf(gBattery.current() * 1000);
-    S += "\r\nI\t" + String(intVal, 10);
-    intVal = roundf(gBattery.current() * gBattery.voltage());
-    S += "\r\nP\t" + String(intVal, 10);
-    intVal = roundf(stats.consumedAs / 3.6);
-    S += "\r\nCE\t" + String(intVal);
-    intVal = roundf(gBattery.soc() * 1000);
-    S += "\r\nSOC\t" + String(intVal, 10);
+
+    frame.begin();
+    frame.addHex("PID", PID, "0x");
+    frame.add("V", lroundf(gBattery.voltage() * 1000));
+    frame.add("I", lroundf(gBattery.current() * 1000));
+    frame.add("P", lroundf(gBattery.current() * gBattery.voltage()));
+    frame.add("CE", lroundf(stats.consumedAs / 3.6));
+    frame.add("SOC", lroundf(gBattery.soc() * 1000));
     if (gBattery.tTg() == INFINITY) {
         intVal = -1;
     } else {
         intVal = roundf(gBattery.tTg() / 60);
     }
-    S += "\r\nTTG\t" + String(intVal, 10);
-    S += "\r\nAlarm\tOFF";
-    S += "\r\nRelay\tOFF";
-    S += "\r\nAR\t0";
-    S += "\r\nAR\t0";
-    S += "\r\nBMV\tINR226";
-    S += "\r\nFW\t" + String(AppId, 16);
-    S += "\r\nMON\t" + String(gVictronDevice) ;
-    S += "\r\nChecksum\t";
-
-    uint8_t cs = calcChecksum(S);
-    SERIAL_VICTRON.write(S.c_str());
-    SERIAL_VICTRON.write(cs);
+    frame.add("TTG", intVal);
+    if (!isnan(gBattery.temperature())) {
+        frame.add("T", lroundf(gBattery.temperature()));
+    }
+    // Alarm reason: 1 low voltage, 2 high voltage
+    intVal = (gBattery.lowVoltageAlarm() ? 1 : 0) | (gBattery.highVoltageAlarm() ? 2 : 0);
+    frame.add("Alarm", intVal ? "ON" : "OFF");
+    frame.add("Relay", "OFF");
+    frame.add("AR", intVal);
+    frame.add("BMV", "INR226");
+    frame.addHex("FW", AppId);
+    frame.add("MON", gVictronDevice);
+    frame.end();
+    return frame;
 }
 
-void sendHistoryBlock() {
+const VeDirectFrame& victronHistoryBlock() {
     const Statistics& stats = gBattery.statistics();
-    int intVal;
-    String S = "\r\nH1\t" + String(stats.deepestDischarge);
-    S += "\r\nH2\t" + String(stats.lastDischarge);
-    S += "\r\nH3\t" + String(stats.averageDischarge);
-    S += "\r\nH4\t" + String(stats.numChargeCycles);
-    S += "\r\nH5\t" + String(stats.numFullDischarge);
-    intVal = roundf(stats.sumApHDrawn);
-    S += "\r\nH6\t" + String(intVal);
-    S += "\r\nH7\t" + String(stats.minBatVoltage);
-    S += "\r\nH8\t" + String(stats.maxBatVoltage);
-    S += "\r\nH9\t";
+
+    frame.begin();
+    frame.add("H1", stats.deepestDischarge);
+    frame.add("H2", stats.lastDischarge);
+    frame.add("H3", stats.averageDischarge);
+    frame.add("H4", stats.numChargeCycles);
+    frame.add("H5", stats.numFullDischarge);
+    frame.add("H6", lroundf(stats.sumApHDrawn));
+    frame.add("H7", stats.minBatVoltage);
+    frame.add("H8", stats.maxBatVoltage);
     if (stats.secsSinceLastFull < 0) {
-        S += "---";
+        frame.add("H9", "---");
     } else {
-        S += String(stats.secsSinceLastFull);
+        frame.add("H9", stats.secsSinceLastFull);
     }
-    S += "\r\nH10\t" + String(stats.numAutoSyncs);
-    S += "\r\nH11\t" + String(stats.numLowVoltageAlarms);
-    S += "\r\nH12\t" + String(stats.numHighVoltageAlarms);
-    intVal = roundf(stats.amountDischargedEnergy);
-    S += "\r\nH17\t" + String(intVal);
-    intVal = roundf(stats.amountChargedEnergy);
-    S += "\r\nH18\t" + String(intVal);
-
-    S += "\r\nChecksum\t";
-    uint8_t cs = calcChecksum(S);
-    SERIAL_VICTRON.write(S.c_str());
-    SERIAL_VICTRON.write(cs);
+    frame.add("H10", stats.numAutoSyncs);
+    frame.add("H11", stats.numLowVoltageAlarms);
+    frame.add("H12", stats.numHighVoltageAlarms);
+    frame.add("H17", lroundf(stats.amountDischargedEnergy));
+    frame.add("H18", lroundf(stats.amountChargedEnergy));
+    frame.end();
+    return frame;
 }
 
-#define char2int(VAL) ((VAL) > '@' ? ((VAL) & 0xDF) - 'A' + 10 : (VAL) - '0')
+// Starts the next hex answer or text block. Answers go first, a text
+// block is only built when its turn comes, so its values are current.
+static bool txStart() {
+    // The debug marks share the UART on the ESP8266, they mustn't block
+    if (SERIAL_VICTRON.availableForWrite() < 4) {
+        return false;
+    }
+    if (hexSize) {
+        txState = TX_HEX;
+    } else if (textDue & TEXT_SMALL) {
+        textDue &= ~TEXT_SMALL;
+        SERIAL_DBG.print(".");
+        txState = victronSmallBlock().overflow() ? TX_IDLE : TX_TEXT;
+    } else if (textDue & TEXT_HISTORY) {
+        textDue &= ~TEXT_HISTORY;
+        SERIAL_DBG.println("*");
+        txState = victronHistoryBlock().overflow() ? TX_IDLE : TX_TEXT;
+    } else {
+        return false;
+    }
+    txPos = 0;
+    return true;
+}
 
-bool readByte(uint8_t& value) {
-    char result[2];
-    int read;
-    read = SERIAL_VICTRON.readBytes(result,1);
-    if (read == 1) {
-        if (result[0] < '0') {
-            value = (uint8_t)result[0];
-            return true;
+// Feeds the UART FIFO as far as it has room
+static void txLoop() {
+    while (txState != TX_IDLE || txStart()) {
+        if (txState == TX_IDLE) {
+            continue;
         }
-        read = SERIAL_VICTRON.readBytes(result+1,1);
-        if (read == 1) {
-            value = (uint8_t)((char2int(result[0]) << 4) | char2int(result[1]));
-            return true;
+        const uint8_t* data = txState == TX_HEX ? hexBuffer : frame.data();
+        uint16_t size = txState == TX_HEX ? hexSize : frame.size();
+        int room = SERIAL_VICTRON.availableForWrite();
+        uint16_t chunk = room > 0 ? min((uint16_t)room, (uint16_t)(size - txPos)) : 0;
+        if (chunk) {
+            SERIAL_VICTRON.write(data + txPos, chunk);
+            txPos += chunk;
         }
+        if (txPos < size) {
+            return;
+        }
+        if (txState == TX_HEX) {
+            hexSize = 0;
+        }
+        txState = TX_IDLE;
     }
+}
 
-    SERIAL_DBG.printf("readByte: Read failure read %d %c %c\r\n", read, result[0], result[1]);
-    return false;
+static HexParser parser;
+
+// Runs the command the parser completed
+static void execute() {
+    uint8_t command = parser.command();
+    const uint8_t* data = parser.data();
+    uint8_t size = parser.dataSize();
+    uint16_t address = 0;
+    uint8_t flags = 0;
+
+    hexHost = true;
+    if (command == COMMAND_GET || command == COMMAND_SET) {
+        // Address and flags come first, the value follows
+        if (size < 3) {
+            return;
+        }
+        address = data[0] | data[1] << 8;
+        flags = data[2];
+        data += 3;
+        size -= 3;
+    }
+    if (command < NUM_HANDLERS) {
+        commandHandlers[command](command, address, flags, data, size);
+    } else {
+        commandUnknown(command, address, flags, data, size);
+    }
 }
 
+// Parses what the UART received so far, as many commands as there are
+static void rxLoop(unsigned long now) {
+    if (parser.busy() && now - lastHexCmdMillis > UART_TIMEOUT) {
+        // The rest of this command won't come
+        parser.reset();
+        lastHexCmdMillis = 0;
+    }
+    // Commands wait in the UART while an answer might not fit
+    while (SERIAL_VICTRON.available() && hexSize + HEX_ANSWER_MAX <= (int)sizeof(hexBuffer)) {
+        uint8_t c = SERIAL_VICTRON.read();
+        if (c == ':') {
+            lastHexCmdMillis = now;
+        }
+        if (parser.feed(c) == HexParser::COMPLETE) {
+            execute();
+        }
+    }
+}
+
+// Registers pushed with COMMAND_ASYNC once they moved by the threshold (in
+// the unit of the register), but not more often than every minIntervalMs
+struct AsyncRegister {
+    uint16_t id;
+    uint16_t threshold;
+    uint16_t minIntervalMs;
+};
 
-void rxData(unsigned long now) {
-    static STATE status = IDLE;
-    static uint8_t command;
-    static uint16_t address;
-    static uint8_t flags;
-    static uint8_t checksum;
-    static uint8_t currIndex;
-    static uint8_t valueBuffer[64];
+static const AsyncRegister asyncRegisters[] = {
+    {0x0FFF, 10, 5000},  // SOC, 0.1%
+    {0xED8D, 5, 1000},   // Voltage, 0.05V
+    {0xED8F, 5, 1000},   // Current, 0.5A
+    {0x031E, 1, 0},      // Alarm reason, at once
+};
 
-    uint8_t inbyte;
-    bool ok;
+static const uint8_t NUM_ASYNC = sizeof(asyncRegisters) / sizeof(asyncRegisters[0]);
 
-    while (true) {
-        //SERIAL_DBG.printf("Status is: %d\r\n",status);
-        if (status != IDLE && (now - lastHexCmdMillis > UART_TIMEOUT)) {
-            status = IDLE;
-            lastHexCmdMillis = 0;
-        }
+// What the host got last and when
+static int32_t asyncValue[NUM_ASYNC];
+static unsigned long asyncMillis[NUM_ASYNC];
+static bool asyncSent[NUM_ASYNC];
 
-        switch (status) {
-            case IDLE:
-                inbyte = SERIAL_VICTRON.read();
-                //SERIAL_DBG.printf("%x\r\n",inbyte); 
-                if (inbyte == ':') {
-                    lastHexCmdMillis = now;
-                    // A new command starts
-                    checksum = 0;
-                    command = COMMAND_UNKNOWN;
-                    flags = 0;
-                    address = 0;
-                    status = READ_COMMAND;
-                }
-                return;
-            case READ_COMMAND:
-                inbyte = SERIAL_VICTRON.read();
-                command = char2int(inbyte);
-                checksum += command;
-                if (command < NUM_COMMANDS) {
-                    status = (STATE)command;
-                } else {
-                    // This is an unknow command. Trigger error mnessage
-                    status = EXECUTE;
-                }
-                // Continue in the loop
-                break;
-            case COMMAND_PING:
-            case COMMAND_APP_VERSION:
-            case COMMAND_PRODUCT_ID:
-            case COMMAND_RESTART:
-                status = READ_CHECKSUM;
-                // Return to wait for more input
-                return;
-            case COMMAND_GET:
-            case COMMAND_SET:
-                status = READ_REGISTER;
-                return;
-                break;
-            case READ_REGISTER:
-                ok = readByte(valueBuffer[1]);
-                if (ok) {
-                    checksum += valueBuffer[1];
-                    ok = readByte(valueBuffer[0]);
-                }
-                if (ok) {
-                    checksum += valueBuffer[0];
-                    address = valueBuffer[0] << 8 | valueBuffer[1];
-                    status = READ_FLAGS;
-                } else {
-                    status = IDLE;
-                }
-                return;
-            case READ_FLAGS:
-                ok = readByte(flags);
-                checksum += flags;
-                if (ok) {
-                    status = (command == COMMAND_GET ? READ_CHECKSUM : READ_VALUE);
-                } else {
-                    status = IDLE;
-                }
-                return;
-            case READ_VALUE:
-                currIndex = 0;                                
-                status = READ_DATA;
-                // Fall through                
-            case READ_DATA:                       
-                ok = readByte(valueBuffer[currIndex]);
-                //SERIAL_DBG.printf("Read %X\r\n", valueBuffer[currIndex]);
-                if (ok) {
-                    if (valueBuffer[currIndex] == '\r') {                        
-                        return;
-                    }
-                    if (valueBuffer[currIndex] == '\n') {
-                        // End of command
-                        // We already read the checksum as the last character 
-                        // Overwrite it with 0 (if it's a string it's correctly terminated then)
-                        valueBuffer[--currIndex] = 0;
-                        if (checksum != 0x55) {
-                            // This is an error
-                            status = IDLE;
-                        } else {
-                            status = EXECUTE;
-                        }                        
-                        break;
-                    }
-                    checksum += valueBuffer[currIndex++];
-                    if (currIndex >= sizeof(valueBuffer)) {
-                        // This message is too long for us....
-                        status = IDLE;
-                    }
-                } else {
-                    // Error while reading from UART
-                    SERIAL_DBG.printf("Read failed (ix %d, checksum %x)\r\n",currIndex,checksum);
-                    status = IDLE;
-                }
-                return;
-            case READ_CHECKSUM:
-                ok = readByte(inbyte);
-                if (!ok || (uint8_t)(checksum + inbyte) != 0x55) {
-                    // Checksum failure
-                    // Just ignore this
-                     SERIAL_DBG.printf("Ok: %d Checksum failure %X MY sum is %X\r\n",ok,inbyte,checksum);
-                    status = IDLE;
-                } else {
-                    status = COMPLETE;
-                }
-                return;
-            case COMPLETE:
-                inbyte = SERIAL_VICTRON.read();
-                if (inbyte == '\r') return;
-                if (inbyte == '\n') {
-                    status = EXECUTE;
-                } else {
-                    // This would be a violation of the protocol
-                    status = IDLE;
-                    return;
-                }
-                break;
-            case EXECUTE:
-                if (command < NUM_COMMANDS) {
-                    commandHandlers[command](command, address, flags, valueBuffer, currIndex);
-                } else {
-                    commandUnknown(command, address, flags, valueBuffer, currIndex);
-                }
-                status = IDLE;
-                return;
-            case COMMAND_ASYNC:
-                status = IDLE;
-                return;
-            default:
-                status = IDLE;
-                return;
+static void asyncLoop(unsigned long now) {
+    if (!hexHost || !sensorPresent(0)) {
+        return;
+    }
+    for (uint8_t i = 0; i < NUM_ASYNC; ++i) {
+        const AsyncRegister& async = asyncRegisters[i];
+        if (asyncSent[i] && now - asyncMillis[i] < async.minIntervalMs) {
+            continue;
+        }
+        const HexRegister* reg = hexRegisterFind(async.id);
+        if (!reg || !reg->get) {
+            // Not a number register, nothing to compare
+            continue;
+        }
+        int32_t value = reg->get();
+        if (asyncSent[i] && labs((long)value - asyncValue[i]) < async.threshold) {
+            continue;
+        }
+        if (hexSize + HEX_ANSWER_MAX > (int)sizeof(hexBuffer)) {
+            // The rest waits for the next pass
+            return;
         }
+        uint8_t message[4 + HEX_MAX_VALUE];
+        uint8_t size;
+        message[0] = COMMAND_ASYNC;
+        message[1] = (uint8_t)async.id;
+        message[2] = (uint8_t)(async.id >> 8);
+        message[3] = hexRegisterGet(async.id, message + 4, size);
+        sendAnswer(message, 4 + size);
+        asyncValue[i] = value;
+        asyncMillis[i] = now;
+        asyncSent[i] = true;
     }
 }
 
@@ -447,22 +384,65 @@ void victronLoop() {
     now = millis();
 
     if (gVictronEanbled) {
-        while (SERIAL_VICTRON.available()) {
-            //SERIAL_DBG.println("Data available");
-            rxData(now);
+        rxLoop(now);
+        if (hexConfigChanged()) {
+            // gParamsChanged would be cleared before the sensor sees it
+            sensorUpdateParameters();
+            wifiSetVictronVals();
+            wifiStoreConfig();
         }
 
         stopText = ((lastHexCmdMillis > 0) && (now - lastHexCmdMillis < UPDATE_INTERVAL));
-        if (!stopText && (now - lastSent >= UPDATE_INTERVAL)) {
-            SERIAL_DBG.print(".");
-            sendSmallBlock();
+        // The frames report the first battery only
+        if (sensorPresent(0) && !stopText && (now - lastSent >= UPDATE_INTERVAL)) {
+            textDue |= TEXT_SMALL;
             lastSent = now;
             lastHexCmdMillis = 0;
             if (now - lastSentHistory >= UPDATE_INTERVAL * 10) {
-                SERIAL_DBG.println("*");
-                sendHistoryBlock();
+                textDue |= TEXT_HISTORY;
                 lastSentHistory = now;
             }
         }
+        asyncLoop(now);
+        txLoop();
     }
 }
+
+#ifdef BENCH_VEDIRECT
+// The bench env links with --wrap=malloc and --wrap=realloc, so every heap
+// allocation (String, new) passes here
+static uint32_t numAllocations = 0;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    ++numAllocations;
+    return __real_malloc(size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    ++numAllocations;
+    return __real_realloc(ptr, size);
+}
+}
+
+// Cost of building the text frames on the target
+void benchmarkVictron() {
+    static const uint16_t NUM_FRAMES = 1000;
+    const char* const names[] = {"small block", "history block"};
+
+    for (uint8_t block = 0; block < 2; ++block) {
+        uint32_t allocations = numAllocations;
+        uint32_t start = ESP.getCycleCount();
+        for (uint16_t i = 0; i < NUM_FRAMES; ++i) {
+            block ? victronHistoryBlock() : victronSmallBlock();
+        }
+        uint32_t cycles = ESP.getCycleCount() - start;
+        allocations = numAllocations - allocations;
+        SERIAL_DBG.printf("VE.Direct %s: %u cycles/frame, %u bytes, %u heap allocations in %u frames\n", names[block],
+                          cycles / NUM_FRAMES, (unsigned)frame.size(), allocations, NUM_FRAMES);
+    }
+}
+#endif
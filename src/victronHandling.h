@@ -1,5 +1,15 @@
 #pragma once
 
+#include "veDirectFrame.h"
 
 extern void victronInit();
 extern void victronLoop();
+
+// Build the text frames of the first battery into the static frame buffer,
+// what victronLoop() sends. For the benchmarks.
+const VeDirectFrame& victronSmallBlock();
+const VeDirectFrame& victronHistoryBlock();
+
+#ifdef BENCH_VEDIRECT
+void benchmarkVictron();
+#endif
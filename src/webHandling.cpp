@@ -24,6 +24,9 @@
 
 #include "common.h"
 #include "statusHandling.h"
+#include "sensorHandling.h"
+#include "historyHandling.h"
+#include "timeHandling.h"
 
 #define SOC_RESPONSE \
 "<!DOCTYPE HTML>\
@@ -53,7 +56,7 @@
 const char wifiInitialApPassword[] = "12345678";
 
 // -- Configuration specific key. The value should be modified if config structure was changed.
-#define CONFIG_VERSION "C1"
+#define CONFIG_VERSION "C7"
 
 // -- When CONFIG_PIN is pulled to ground on startup, the Thing will use the initial
 //      password to buld an AP. (E.g. in case of lost password)
@@ -112,6 +115,26 @@ uint16_t gMaxCurrentA;
 
 uint16_t gModbusId;
 
+uint16_t gTransientThresholdA;
+
+uint16_t gTransientDurationMs;
+
+uint16_t gLowVoltageAlarmmV;
+
+uint16_t gHighVoltageAlarmmV;
+
+uint16_t gRestCurrentmA;
+
+uint16_t gRestTimeMin;
+
+bool gUseLearnedCapacity = false;
+
+uint16_t gPeukertExponent;
+
+uint16_t gTemperatureCoefficient;
+
+bool gTtgFromProfile = false;
+
 bool gModbusEanbled = false;
 
 bool gVictronEanbled = true;
@@ -189,6 +212,19 @@ iotwebconf::UIntTParameter<uint16_t> minSoc =
   placeholder("1..100").
   build();
 
+static const char learnValues[][STRING_LEN] = { "s", "u" };
+static const char learnNames[][STRING_LEN] = { "Show only", "Use instead of the above" };
+
+iotwebconf::SelectTParameter<STRING_LEN> learnChooserParam =
+   iotwebconf::Builder<iotwebconf::SelectTParameter<STRING_LEN>>("learn").
+   label("Learned capacity and efficiency").
+   optionValues((const char*)learnValues).
+   optionNames((const char*)learnNames).
+   optionCount(sizeof(learnValues) / STRING_LEN).
+   nameLength(STRING_LEN).
+   defaultValue("s").
+   build();
+
 IotWebConfParameterGroup fullGroup = IotWebConfParameterGroup("FullD","Full detection");
 
 iotwebconf::UIntTParameter<uint16_t> tailCurrent =
@@ -220,6 +256,107 @@ iotwebconf::UIntTParameter<uint16_t> fullDelay =
   build();
 
 
+IotWebConfParameterGroup transientGroup = IotWebConfParameterGroup("TransC","Transient recording");
+
+iotwebconf::UIntTParameter<uint16_t> transientThreshold =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("trThr").
+  label("Trigger current [A] (0 = off)").
+  defaultValue(0).
+  min(0u).
+  step(1u).
+  placeholder("0..65535").
+  build();
+
+iotwebconf::UIntTParameter<uint16_t> transientDuration =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("trDur").
+  label("Recording time [ms]").
+  defaultValue(100).
+  min(1u).
+  max(1000u).
+  step(1u).
+  placeholder("1..1000").
+  build();
+
+
+IotWebConfParameterGroup alarmGroup = IotWebConfParameterGroup("AlarmC","Voltage alarms");
+
+iotwebconf::UIntTParameter<uint16_t> lowVoltageAlarm =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("lowV").
+  label("Low voltage alarm [mV] (0 = off)").
+  defaultValue(0).
+  min(0u).
+  step(1u).
+  placeholder("0..65535").
+  build();
+
+iotwebconf::UIntTParameter<uint16_t> highVoltageAlarm =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("highV").
+  label("High voltage alarm [mV] (0 = off)").
+  defaultValue(0).
+  min(0u).
+  step(1u).
+  placeholder("0..65535").
+  build();
+
+
+IotWebConfParameterGroup ttgGroup = IotWebConfParameterGroup("TtgC","Time to go");
+
+iotwebconf::UIntTParameter<uint16_t> peukertExponent =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("peuk").
+  label("Peukert exponent [0.01] (100 = off)").
+  defaultValue(105).
+  min(100u).
+  max(150u).
+  step(1u).
+  placeholder("100..150").
+  build();
+
+iotwebconf::UIntTParameter<uint16_t> temperatureCoefficient =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("tcoef").
+  label("Capacity loss below 20&deg;C [0.1 %/&deg;C]").
+  defaultValue(5).
+  min(0u).
+  max(50u).
+  step(1u).
+  placeholder("0..50").
+  build();
+
+static const char ttgSourceValues[][STRING_LEN] = { "a", "p" };
+static const char ttgSourceNames[][STRING_LEN] = { "Average current", "Daily load profile" };
+
+iotwebconf::SelectTParameter<STRING_LEN> ttgSourceParam =
+   iotwebconf::Builder<iotwebconf::SelectTParameter<STRING_LEN>>("ttgsrc").
+   label("Predict from").
+   optionValues((const char*)ttgSourceValues).
+   optionNames((const char*)ttgSourceNames).
+   optionCount(sizeof(ttgSourceValues) / STRING_LEN).
+   nameLength(STRING_LEN).
+   defaultValue("a").
+   build();
+
+
+IotWebConfParameterGroup restGroup = IotWebConfParameterGroup("RestC","SOC from resting voltage");
+
+iotwebconf::UIntTParameter<uint16_t> restCurrent =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("restI").
+  label("Rest current [mA]").
+  defaultValue(200).
+  min(0u).
+  step(1u).
+  placeholder("0..65535").
+  build();
+
+iotwebconf::UIntTParameter<uint16_t> restTime =
+  iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("restT").
+  label("Rest time [min] (0 = off)").
+  defaultValue(0).
+  min(0u).
+  max(1440u).
+  step(1u).
+  placeholder("0..1440").
+  build();
+
+
 IotWebConfParameterGroup communicationGroup = IotWebConfParameterGroup("comm","Communication settings");
 iotwebconf::UIntTParameter<uint16_t> modbusId =
   iotwebconf::Builder<iotwebconf::UIntTParameter<uint16_t>>("mbid").
@@ -264,6 +401,11 @@ label("Name").
 defaultValue(gCustomName).
 build();
 
+void wifiSetAlarmVals() {
+    lowVoltageAlarm.value() = gLowVoltageAlarmmV;
+    highVoltageAlarm.value() = gHighVoltageAlarmmV;
+}
+
 void wifiSetShuntVals() {
     shuntResistance.value() = gShuntResistancemR;
     maxCurrent.value() = gMaxCurrentA;
@@ -271,6 +413,18 @@ void wifiSetShuntVals() {
     currentFactor.value() = gCurrentCalibrationFactor;
 }
 
+// The values VE.Direct can set
+void wifiSetVictronVals() {
+    battCapacity.value() = gCapacityAh;
+    chargeEfficiency.value() = gChargeEfficiencyPercent;
+    minSoc.value() = gMinPercent;
+    tailCurrent.value() = gTailCurrentmA;
+    fullVoltage.value() = gFullVoltagemV;
+    fullDelay.value() = gFullDelayS;
+    peukertExponent.value() = gPeukertExponent;
+    strncpy(nameParam.value(), gCustomName, sizeof(gCustomName));
+}
+
 void wifiSetModbusId() {
     modbusId.value() = gModbusId;
 }
@@ -283,6 +437,8 @@ void wifiStoreConfig() {
 void wifiConnected()
 {
    ArduinoOTA.begin();
+   // UTC, the history is stored with it
+   configTime(0, 0, "pool.ntp.org");
 }
 
 void onSetSoc() {
@@ -298,6 +454,117 @@ void onSetSoc() {
 } 
 
 
+// The last transient recording, one line per point. The time is relative
+// to the trigger, so the points before it are negative.
+void handleTransientCsv() {
+  const TransientHeader& header = sensorTransientHeader();
+  const TransientPoint* points = sensorTransientPoints();
+  char line[48];
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/csv", "");
+  server.sendContent("time_us,current_A,voltage_V\n");
+  String s;
+  for (uint16_t i = 0; i < header.count; ++i) {
+    snprintf(line, sizeof(line), "%ld,%.3f,%.3f\n", (long)(points[i].timeUs - header.triggerUs),
+             points[i].shunt * header.currentLsb, points[i].bus * header.voltageLsb);
+    s += line;
+    if (s.length() > 1000) {
+      server.sendContent(s);
+      s = "";
+    }
+  }
+  server.sendContent(s);
+  server.sendContent("");
+}
+
+// The same as the raw header and point structs (little endian)
+void handleTransientBin() {
+  const TransientHeader& header = sensorTransientHeader();
+
+  server.setContentLength(sizeof(header) + header.count * sizeof(TransientPoint));
+  server.send(200, "application/octet-stream", "");
+  server.sendContent((const char*)&header, sizeof(header));
+  server.sendContent((const char*)sensorTransientPoints(), header.count * sizeof(TransientPoint));
+}
+
+// The per minute history of the first battery. from and to are seconds
+// since 1970, the default is the last day. Without a set clock the times
+// are counted minutes and everything is sent.
+void handleHistoryCsv() {
+  HistoryStore* store = historyStore();
+  uint32_t now = epochSeconds();
+  uint32_t from = now ? now - 86400 : 0;
+  uint32_t to = UINT32_MAX;
+  char line[96];
+
+  if (!store) {
+    server.send(404, "text/plain", "No history");
+    return;
+  }
+  if (server.hasArg("from")) {
+    from = server.arg("from").toInt();
+  }
+  if (server.hasArg("to")) {
+    to = server.arg("to").toInt();
+  }
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/csv", "");
+  server.sendContent("time,current_A,current_min_A,current_max_A,voltage_V,soc_percent,in_mAh,out_mAh\n");
+  String s;
+  HistoryStore::Reader reader(*store, from / 60, to / 60);
+  HistoryPoint point;
+  while (reader.next(point)) {
+    snprintf(line, sizeof(line), "%lu,%.2f,%.2f,%.2f,%.2f,%.1f,%u,%u\n", (unsigned long)point.minute * 60,
+             point.current * 0.01f, point.currentMin * 0.01f, point.currentMax * 0.01f, point.voltage * 0.01f,
+             point.soc * 0.1f, point.mAhIn, point.mAhOut);
+    s += line;
+    if (s.length() > 1000) {
+      server.sendContent(s);
+      s = "";
+    }
+  }
+  server.sendContent(s);
+  server.sendContent("");
+}
+
+// One level of the rollups, oldest point first: [mean A, min A, max A, Wh].
+// level is second, minute, hour (default) or day. end is the time the
+// newest point ended (seconds since 1970, 0 without a set clock).
+void handleRollupJson() {
+  static const char* const names[RollupPyramid::NUM_LEVELS] = {"second", "minute", "hour", "day"};
+  const RollupPyramid& rollup = historyRollup();
+  RollupPyramid::Level level = RollupPyramid::LEVEL_HOUR;
+  uint32_t now = epochSeconds();
+  char line[64];
+
+  for (uint8_t i = 0; i < RollupPyramid::NUM_LEVELS; ++i) {
+    if (server.arg("level") == names[i]) {
+      level = (RollupPyramid::Level)i;
+    }
+  }
+  uint32_t age = (uptimeMillis() - rollup.lastCloseMs(level)) / 1000;
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  String s = "{\"level\":\"" + String(names[level]) + "\",\"period\":" + String(RollupPyramid::periodSeconds(level)) +
+             ",\"end\":" + String(now && rollup.count(level) ? now - age : 0) + ",\"points\":[";
+  for (uint16_t i = 0; i < rollup.count(level); ++i) {
+    const RollupPyramid::Point& point = rollup.point(level, i);
+    snprintf(line, sizeof(line), "%s[%.3f,%.3f,%.3f,%.3f]", i ? "," : "", point.currentmA * 0.001f,
+             point.minmA * 0.001f, point.maxmA * 0.001f, point.energyWh);
+    s += line;
+    if (s.length() > 1000) {
+      server.sendContent(s);
+      s = "";
+    }
+  }
+  s += "]}";
+  server.sendContent(s);
+  server.sendContent("");
+}
+
 void handleSetRuntime() {
 String s = "<!DOCTYPE html><html lang=\"en\"><head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1, user-scalable=no\"/>";  
   s += "<title>Set runtime data</title></head><body>";
@@ -323,11 +590,25 @@ void wifiSetup()
   shuntGroup.addItem(&battCapacity);
   shuntGroup.addItem(&chargeEfficiency);
   shuntGroup.addItem(&minSoc);
+  shuntGroup.addItem(&learnChooserParam);
 
   fullGroup.addItem(&fullVoltage);
   fullGroup.addItem(&tailCurrent);
   fullGroup.addItem(&fullDelay);
 
+  transientGroup.addItem(&transientThreshold);
+  transientGroup.addItem(&transientDuration);
+
+  alarmGroup.addItem(&lowVoltageAlarm);
+  alarmGroup.addItem(&highVoltageAlarm);
+
+  ttgGroup.addItem(&peukertExponent);
+  ttgGroup.addItem(&temperatureCoefficient);
+  ttgGroup.addItem(&ttgSourceParam);
+
+  restGroup.addItem(&restCurrent);
+  restGroup.addItem(&restTime);
+
   // communication settings
 
   communicationGroup.addItem(&nameParam);
@@ -343,6 +624,10 @@ void wifiSetup()
   iotWebConf.addParameterGroup(&sysConfGroup);
   iotWebConf.addParameterGroup(&shuntGroup);
   iotWebConf.addParameterGroup(&fullGroup);
+  iotWebConf.addParameterGroup(&transientGroup);
+  iotWebConf.addParameterGroup(&alarmGroup);
+  iotWebConf.addParameterGroup(&ttgGroup);
+  iotWebConf.addParameterGroup(&restGroup);
   iotWebConf.addParameterGroup(&communicationGroup);
 
   iotWebConf.setConfigSavedCallback(&configSaved);
@@ -368,6 +653,10 @@ void wifiSetup()
   
   server.on("/setruntime", handleSetRuntime);
   server.on("/setsoc",HTTP_POST,onSetSoc);
+  server.on("/transient.csv", handleTransientCsv);
+  server.on("/transient.bin", handleTransientBin);
+  server.on("/history.csv", handleHistoryCsv);
+  server.on("/rollup.json", handleRollupJson);
 }
 
 void wifiLoop()
@@ -417,18 +706,91 @@ void handleRoot()
   s += "<li>Victron enabled   : " + String(gVictronEanbled ? "true" : "false");
   s += "<li>Victron dev. type : " + String(victronTypeNames[atoi(gVictronDevice)+9]);
   s += "<li>Modbus ID         : " + String(gModbusId);
+  s += "<li>Transient trigger : " + String(gTransientThresholdA) + " A, " + String(gTransientDurationMs) + " ms";
+  s += "<li>Voltage alarms    : " + String(gLowVoltageAlarmmV) + " / " + String(gHighVoltageAlarmmV) + " mV";
+  s += "<li>Time to go model  : Peukert " + String(gPeukertExponent / 100.0f, 2) + ", " +
+       String(gTemperatureCoefficient / 10.0f, 1) + " %/&deg;C" + (gTtgFromProfile ? ", load profile" : "");
+  s += "<li>Rest sync         : " + String(gRestCurrentmA) + " mA, " + String(gRestTimeMin) + " min";
+  s += "<li>Use learned values: " + String(gUseLearnedCapacity ? "true" : "false");
   s += "</ul><hr><br>";
 
   s += "<br><b>Dynamic Values</b>";
   
   if (gSensorInitialized) {
-    s += "<ul> <li>Battery Voltage: " + String(gBattery.voltage()) + " V";
-    s += "<li>Shunt current  : " + String(gBattery.current(),3) + " A";
-    s += "<li>Avg consumption: " + String(gBattery.averageCurrent(),3) + " A";
-    s += "<li>Battery soc    : " + String(gBattery.soc(),3);
-    s += "<li>Time to go     : " + String(gBattery.tTg()) + " s";
-    s += "<li>Battery full   : " + String(gBattery.isFull()?"true":"false");
-    s += "</ul>";
+    if (NUM_SENSORS > 1) {
+      s += "<b>Sensor 1</b>";
+    }
+    if (sensorPresent(0)) {
+      s += "<ul> <li>Battery Voltage: " + String(gBattery.voltage()) + " V";
+      s += "<li>Shunt current  : " + String(gBattery.current(),3) + " A";
+      s += "<li>Avg consumption: " + String(gBattery.averageCurrent(),3) + " A";
+      {
+        static const char* const names[] = {"1 min", "15 min", "1 h"};
+        const CurrentStatistics& currentStats = gBattery.currentStatistics();
+        for (uint8_t i = 0; i < CurrentStatistics::NUM_HORIZONS; ++i) {
+          CurrentStatistics::Horizon horizon = (CurrentStatistics::Horizon)i;
+          s += "<li>Current " + String(names[i]) + ": avg " + String(currentStats.average(horizon), 3) + " A, min " +
+               String(currentStats.minimum(horizon), 3) + " A, max " + String(currentStats.maximum(horizon), 3) + " A";
+        }
+      }
+      s += "<li>Battery soc    : " + String(gBattery.soc(),3);
+#ifdef SOC_EKF
+      s += " (EKF &plusmn;" + String(gBattery.socEstimator().deviation(), 3) + ")";
+#endif
+      s += "<li>Time to go     : " + String(gBattery.tTg()) + " s";
+      s += "<li>Load profile   : " + String(gBattery.loadProfile().learnedBuckets()) + " of " +
+           String(LoadProfile::BUCKETS) + " quarter hours learned";
+      if (!isnan(gBattery.temperature())) {
+        s += "<li>Temperature    : " + String(gBattery.temperature(), 1) + " &deg;C";
+      }
+      s += "<li>Battery full   : " + String(gBattery.isFull()?"true":"false");
+      if (gBattery.lowVoltageAlarm() || gBattery.highVoltageAlarm()) {
+        s += "<li><font color=\"red\">Alarm          : " + String(gBattery.lowVoltageAlarm() ? "low" : "high") + " voltage</font>";
+      }
+      {
+        const Statistics& stats = gBattery.statistics();
+        s += "<li>Charge cycles  : " + String(stats.numChargeCycles) + ", full discharges " + String(stats.numFullDischarge);
+        const CapacityLearner& learner = gBattery.capacityLearner();
+        s += "<li>Learned        : capacity " + String(learner.capacityAs() / 3600.0f, 1) + " Ah (" +
+             String(learner.capacitySamples()) + " samples), efficiency " + String(learner.efficiency() * 100.0f, 1) +
+             " % (" + String(learner.efficiencySamples()) + " samples)";
+        s += "<li>Synchronised   : " + String(stats.numAutoSyncs) + " times full, " + String(gBattery.restSyncs()) + " times at rest";
+        s += "<li>Discharge      : last " + String(stats.lastDischarge) + " mAh, average " + String(stats.averageDischarge) +
+             " mAh, deepest " + String(stats.deepestDischarge) + " mAh";
+      }
+      s += "<li>Sample period  : " + String(sensorSamplePeriod() * 1000.0f, 2) + " ms";
+      s += "<li>I2C time/sample: " + String(sensorI2cTimeUs()) + " us (max " + String(sensorI2cTimeMaxUs()) + " us)";
+      s += "<li>Loop stall max : " + String(sensorLoopStallMaxUs() / 1000.0f, 1) + " ms";
+      if (sensorTransientHeader().count) {
+        s += "<li>Last transient : <a href='transient.csv'>csv</a> <a href='transient.bin'>bin</a>";
+        if (NUM_SENSORS > 1) {
+          s += " (sensor " + String(sensorTransientHeader().sensor + 1) + ")";
+        }
+      }
+      if (historyStore()) {
+        s += "<li>History        : <a href='history.csv'>csv</a> (last day)";
+      }
+      s += "<li>Rollups        : <a href='rollup.json?level=minute'>minutes</a> <a href='rollup.json'>hours</a> "
+           "<a href='rollup.json?level=day'>days</a>";
+      s += "</ul>";
+    } else {
+      s += "<ul><li>not found</ul>";
+    }
+    for (uint8_t i = 1; i < NUM_SENSORS; ++i) {
+      s += "<b>Sensor " + String(i + 1) + "</b>";
+      if (sensorPresent(i)) {
+        s += "<ul> <li>Battery Voltage: " + String(gBatteries[i].voltage()) + " V";
+        s += "<li>Shunt current  : " + String(gBatteries[i].current(),3) + " A";
+        s += "<li>Avg consumption: " + String(gBatteries[i].averageCurrent(),3) + " A";
+        s += "<li>Battery soc    : " + String(gBatteries[i].soc(),3);
+        s += "<li>Time to go     : " + String(gBatteries[i].tTg()) + " s";
+        s += "<li>Battery full   : " + String(gBatteries[i].isFull()?"true":"false");
+        s += "<li>Sample period  : " + String(sensorSamplePeriod(i) * 1000.0f, 2) + " ms";
+        s += "</ul>";
+      } else {
+        s += "<ul><li>not found</ul>";
+      }
+    }
   } else {
     s += "<br><div><font color=\"red\" size=+1><b>Sensor failure!</b></font></div><br>";
   }
@@ -450,10 +812,20 @@ void convertParams() {
     gCapacityAh = battCapacity.value();
     gChargeEfficiencyPercent = chargeEfficiency.value();
     gMinPercent = minSoc.value();
+    gUseLearnedCapacity = strcmp(learnChooserParam.value(), "u") == 0;
     gTailCurrentmA = tailCurrent.value();
     gFullVoltagemV = fullVoltage.value();
     gFullDelayS = fullDelay.value();
     gModbusId = modbusId.value();
+    gTransientThresholdA = transientThreshold.value();
+    gTransientDurationMs = transientDuration.value();
+    gLowVoltageAlarmmV = lowVoltageAlarm.value();
+    gHighVoltageAlarmmV = highVoltageAlarm.value();
+    gPeukertExponent = peukertExponent.value();
+    gTemperatureCoefficient = temperatureCoefficient.value();
+    gTtgFromProfile = strcmp(ttgSourceParam.value(), "p") == 0;
+    gRestCurrentmA = restCurrent.value();
+    gRestTimeMin = restTime.value();
     gModbusEanbled = strcmp(protocolChooserParam.value(),"m") == 0; 
     gVictronEanbled = strcmp(protocolChooserParam.value(), "v") == 0;
     strcpy(gCustomName, nameParam.value());
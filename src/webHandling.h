@@ -8,4 +8,6 @@ extern void wifiLoop();
 
 extern void wifiSetModbusId();
 extern void wifiSetShuntVals();
+extern void wifiSetAlarmVals();
+extern void wifiSetVictronVals();
 extern void wifiStoreConfig();
@@ -0,0 +1,138 @@
+#include <string.h>
+#include <unity.h>
+
+#include "hexParser.h"
+
+// GET of 0x0FFF (state of charge) and a PING
+static const char* GET_SOC = ":7FF0F0040\n";
+static const char* PING = ":154\n";
+
+static HexParser parser;
+
+// Feeds the text, returns how many commands completed and counts the failures
+static int feed(const char* text, int* failed = 0) {
+    int complete = 0;
+    for (const char* c = text; *c; ++c) {
+        HexParser::Result result = parser.feed(*c);
+        if (result == HexParser::COMPLETE) {
+            ++complete;
+        } else if (result == HexParser::FAILED && failed) {
+            ++*failed;
+        }
+    }
+    return complete;
+}
+
+static void checkGetSoc() {
+    static const uint8_t expected[] = {0xFF, 0x0F, 0x00};
+    TEST_ASSERT_EQUAL_UINT8(7, parser.command());
+    TEST_ASSERT_EQUAL_UINT8(sizeof(expected), parser.dataSize());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, parser.data(), sizeof(expected));
+}
+
+void setUp() {
+    parser = HexParser();
+}
+
+void tearDown() {}
+
+void test_split_at_every_byte() {
+    size_t length = strlen(GET_SOC);
+    for (size_t split = 1; split < length; ++split) {
+        parser = HexParser();
+        char head[16] = {0};
+        memcpy(head, GET_SOC, split);
+        TEST_ASSERT_EQUAL_INT(0, feed(head));
+        TEST_ASSERT_TRUE(parser.busy());
+        TEST_ASSERT_EQUAL_INT(1, feed(GET_SOC + split));
+        TEST_ASSERT_FALSE(parser.busy());
+        checkGetSoc();
+        TEST_ASSERT_EQUAL_UINT32(0, parser.errors());
+    }
+}
+
+void test_terminators() {
+    TEST_ASSERT_EQUAL_INT(1, feed(":7FF0F0040\r\n"));
+    checkGetSoc();
+    TEST_ASSERT_EQUAL_INT(1, feed(GET_SOC));
+    checkGetSoc();
+    TEST_ASSERT_EQUAL_UINT32(0, parser.errors());
+}
+
+void test_bad_checksum() {
+    int failed = 0;
+    TEST_ASSERT_EQUAL_INT(0, feed(":7FF0F0041\n", &failed));
+    TEST_ASSERT_EQUAL_INT(1, failed);
+    TEST_ASSERT_EQUAL_UINT32(1, parser.errors());
+    TEST_ASSERT_FALSE(parser.busy());
+}
+
+void test_odd_nibble_count() {
+    int failed = 0;
+    TEST_ASSERT_EQUAL_INT(0, feed(":7FF0F00400\n", &failed));
+    TEST_ASSERT_EQUAL_INT(1, failed);
+    TEST_ASSERT_EQUAL_UINT32(1, parser.errors());
+}
+
+void test_garbage_then_resync() {
+    int failed = 0;
+    TEST_ASSERT_EQUAL_INT(1, feed(":7FF0Gxyz\n\r" ":7FF0F0040\n", &failed));
+    TEST_ASSERT_EQUAL_INT(1, failed);
+    checkGetSoc();
+    // A ':' inside a command drops it and starts over
+    failed = 0;
+    TEST_ASSERT_EQUAL_INT(1, feed(":7FF0" ":7FF0F0040\n", &failed));
+    TEST_ASSERT_EQUAL_INT(1, failed);
+    checkGetSoc();
+    TEST_ASSERT_EQUAL_UINT32(2, parser.errors());
+}
+
+void test_oversized_frame() {
+    int failed = 0;
+    TEST_ASSERT_EQUAL_INT(0, feed(":8", &failed));
+    for (uint16_t i = 0; i < HexParser::MAX_BYTES + 1; ++i) {
+        feed("00", &failed);
+    }
+    feed("\n", &failed);
+    TEST_ASSERT_EQUAL_INT(1, failed);
+    TEST_ASSERT_EQUAL_UINT32(1, parser.errors());
+    // The longest command still fits
+    char frame[2 * HexParser::MAX_BYTES + 4] = ":8";
+    for (uint16_t i = 0; i < HexParser::MAX_BYTES - 1; ++i) {
+        strcat(frame, "00");
+    }
+    strcat(frame, "4D\n");
+    TEST_ASSERT_EQUAL_INT(1, feed(frame));
+    TEST_ASSERT_EQUAL_UINT8(HexParser::MAX_BYTES - 1, parser.dataSize());
+}
+
+void test_queued_commands() {
+    // Stop at each completed command like the receive loop does
+    const char* text = ":154\n:7FF0F0040\r\n:154\n";
+    uint8_t commands[3];
+    int complete = 0;
+    for (const char* c = text; *c; ++c) {
+        if (parser.feed(*c) == HexParser::COMPLETE) {
+            commands[complete++] = parser.command();
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(3, complete);
+    TEST_ASSERT_EQUAL_UINT8(1, commands[0]);
+    TEST_ASSERT_EQUAL_UINT8(7, commands[1]);
+    TEST_ASSERT_EQUAL_UINT8(1, commands[2]);
+    TEST_ASSERT_EQUAL_UINT8(0, parser.dataSize());
+    TEST_ASSERT_EQUAL_INT(1, feed(PING));
+    TEST_ASSERT_EQUAL_UINT32(0, parser.errors());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_split_at_every_byte);
+    RUN_TEST(test_terminators);
+    RUN_TEST(test_bad_checksum);
+    RUN_TEST(test_odd_nibble_count);
+    RUN_TEST(test_garbage_then_resync);
+    RUN_TEST(test_oversized_frame);
+    RUN_TEST(test_queued_commands);
+    return UNITY_END();
+}